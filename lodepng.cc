@@ -34,6 +34,55 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifdef LODEPNG_COMPILE_DISK
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#endif /*LODEPNG_COMPILE_DISK*/
+
+/*x86 SIMD kernels are compiled with per-function target attributes and chosen at
+runtime from the CPU features, so the rest of the file keeps the baseline
+instruction set. Define LODEPNG_NO_COMPILE_SIMD to leave them out.*/
+#if !defined(LODEPNG_NO_COMPILE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LODEPNG_COMPILE_X86_SIMD
+#include <immintrin.h>
+
+#define LODEPNG_CPU_SSE2 1u
+#define LODEPNG_CPU_SSSE3 2u
+#define LODEPNG_CPU_SSE41 4u
+#define LODEPNG_CPU_PCLMUL 8u
+#define LODEPNG_CPU_AVX2 16u
+
+/*Returns the LODEPNG_CPU_ flags of the SIMD extensions the running CPU supports.*/
+static unsigned lodepng_cpu_features(void)
+{
+  unsigned features = 0;
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("sse2")) features |= LODEPNG_CPU_SSE2;
+  if(__builtin_cpu_supports("ssse3")) features |= LODEPNG_CPU_SSSE3;
+  if(__builtin_cpu_supports("sse4.1")) features |= LODEPNG_CPU_SSE41;
+  if(__builtin_cpu_supports("pclmul")) features |= LODEPNG_CPU_PCLMUL;
+  if(__builtin_cpu_supports("avx2")) features |= LODEPNG_CPU_AVX2;
+  return features;
+}
+
+/*MinGW GCC doesn't realign the stack for 32-byte vectors (GCC bug 54412), so an
+AVX2 local spilled to the stack, as they all are at -O0, can fault on an aligned
+store. The AVX2 kernels are left out there and the SSE ones used instead.*/
+#if !defined(_WIN32) || defined(__clang__)
+#define LODEPNG_COMPILE_X86_AVX2
+#endif
+#endif
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -59,19 +108,133 @@ define them in your own project's source files without needing to change
 lodepng source code. Don't forget to remove "static" if you copypaste them
 from here.*/
 
+#if defined(LODEPNG_COMPILE_PNG) && defined(LODEPNG_COMPILE_DECODER)
+#define LODEPNG_COMPILE_ARENA
+
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define LODEPNG_THREAD_LOCAL thread_local
+#elif defined(_MSC_VER)
+#define LODEPNG_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define LODEPNG_THREAD_LOCAL __thread
+#else /*no thread local storage: only decode with an arena from one thread*/
+#define LODEPNG_THREAD_LOCAL
+#endif
+
+/*The arena the allocators below take memory from on this thread, 0 for the heap.
+The decoder only sets it around its temporary buffers, see lodepng_arena_enter.*/
+static LODEPNG_THREAD_LOCAL LodePNGArena* lodepng_active_arena = 0;
+
+#ifdef LODEPNG_COMPILE_ALLOCATORS
+/*Each arena allocation starts this many bytes after a size_t holding its size,
+and is rounded up to a multiple of it, so all of them are 16-byte aligned.*/
+#define LODEPNG_ARENA_ALIGN 16u
+
+static void lodepng_arena_update_peak(LodePNGArena* arena)
+{
+  size_t wanted = arena->used + arena->spilled;
+  if(wanted > arena->peak) arena->peak = wanted;
+}
+
+/*returns 0 if it doesn't fit, the caller then uses the heap*/
+static void* lodepng_arena_malloc(LodePNGArena* arena, size_t size)
+{
+  size_t need = LODEPNG_ARENA_ALIGN + ((size + LODEPNG_ARENA_ALIGN - 1) & ~(size_t)(LODEPNG_ARENA_ALIGN - 1));
+  unsigned char* result;
+  if(need < size) return 0; /*overflow*/
+  if(need > arena->size - arena->used)
+  {
+    arena->spilled += need;
+    lodepng_arena_update_peak(arena);
+    return 0;
+  }
+  result = arena->data + arena->used;
+  *(size_t*)result = size;
+  arena->last = arena->used;
+  arena->used += need;
+  lodepng_arena_update_peak(arena);
+  return result + LODEPNG_ARENA_ALIGN;
+}
+
+static int lodepng_arena_owns(const LodePNGArena* arena, const void* ptr)
+{
+  const unsigned char* p = (const unsigned char*)ptr;
+  return arena && arena->data && p >= arena->data && p < arena->data + arena->size;
+}
+
+/*the last allocation can be grown or shrunk in place, returns 0 if that isn't possible*/
+static void* lodepng_arena_resize(LodePNGArena* arena, void* ptr, size_t new_size)
+{
+  unsigned char* header = (unsigned char*)ptr - LODEPNG_ARENA_ALIGN;
+  size_t need = LODEPNG_ARENA_ALIGN + ((new_size + LODEPNG_ARENA_ALIGN - 1) & ~(size_t)(LODEPNG_ARENA_ALIGN - 1));
+  if(need < new_size || header != arena->data + arena->last) return 0;
+  if(need > arena->size - arena->last) return 0;
+  *(size_t*)header = new_size;
+  arena->used = arena->last + need;
+  lodepng_arena_update_peak(arena);
+  return ptr;
+}
+#endif /*LODEPNG_COMPILE_ALLOCATORS*/
+
+/*Makes lodepng_malloc take memory from arena (0 for the heap) on this thread, and
+returns the previous one to restore afterwards.*/
+static LodePNGArena* lodepng_arena_enter(LodePNGArena* arena)
+{
+  LodePNGArena* previous = lodepng_active_arena;
+  lodepng_active_arena = arena;
+  return previous;
+}
+#endif /*LODEPNG_COMPILE_PNG && LODEPNG_COMPILE_DECODER*/
+
 #ifdef LODEPNG_COMPILE_ALLOCATORS
 static void* lodepng_malloc(size_t size)
 {
+#ifdef LODEPNG_COMPILE_ARENA
+  if(lodepng_active_arena)
+  {
+    void* result = lodepng_arena_malloc(lodepng_active_arena, size);
+    if(result) return result;
+  }
+#endif /*LODEPNG_COMPILE_ARENA*/
   return malloc(size);
 }
 
+static void lodepng_free(void* ptr);
+
 static void* lodepng_realloc(void* ptr, size_t new_size)
 {
+#ifdef LODEPNG_COMPILE_ARENA
+  LodePNGArena* arena = lodepng_active_arena;
+  if(!ptr) return lodepng_malloc(new_size);
+  if(lodepng_arena_owns(arena, ptr))
+  {
+    size_t old_size = *(size_t*)((unsigned char*)ptr - LODEPNG_ARENA_ALIGN);
+    void* result = lodepng_arena_resize(arena, ptr, new_size);
+    if(result) return result;
+    result = lodepng_malloc(new_size);
+    if(result)
+    {
+      memcpy(result, ptr, old_size < new_size ? old_size : new_size);
+      lodepng_free(ptr);
+    }
+    return result;
+  }
+#endif /*LODEPNG_COMPILE_ARENA*/
   return realloc(ptr, new_size);
 }
 
 static void lodepng_free(void* ptr)
 {
+#ifdef LODEPNG_COMPILE_ARENA
+  LodePNGArena* arena = lodepng_active_arena;
+  if(lodepng_arena_owns(arena, ptr))
+  {
+    /*only the most recent allocation gives its memory back before the reset*/
+    unsigned char* header = (unsigned char*)ptr - LODEPNG_ARENA_ALIGN;
+    if(header == arena->data + arena->last) arena->used = arena->last;
+    return;
+  }
+#endif /*LODEPNG_COMPILE_ARENA*/
   free(ptr);
 }
 #else /*LODEPNG_COMPILE_ALLOCATORS*/
@@ -396,6 +559,139 @@ unsigned lodepng_load_file(unsigned char** out, size_t* outsize, const char* fil
   return lodepng_buffer_file(*out, (size_t)size, filename);
 }
 
+/*reads what is left of a file of unknown size (a pipe, or one whose size can't
+be mapped) into view->data, growing it as needed*/
+#ifdef _WIN32
+static unsigned lodepng_read_rest(LodePNGFileView* view, HANDLE file)
+#else
+static unsigned lodepng_read_rest(LodePNGFileView* view, int file)
+#endif
+{
+  unsigned char* data = 0;
+  size_t size = 0, allocsize = 0;
+  for(;;)
+  {
+#ifdef _WIN32
+    DWORD readsize;
+#else
+    ssize_t readsize;
+#endif
+    if(size == allocsize)
+    {
+      size_t newsize = allocsize ? allocsize * 2 : 65536;
+      unsigned char* newdata = newsize > allocsize ? (unsigned char*)lodepng_realloc(data, newsize) : 0;
+      if(!newdata)
+      {
+        lodepng_free(data);
+        return 83; /*alloc fail*/
+      }
+      data = newdata;
+      allocsize = newsize;
+    }
+#ifdef _WIN32
+    {
+      size_t want = allocsize - size;
+      if(want > 0x40000000u) want = 0x40000000u;
+      if(!ReadFile(file, data + size, (DWORD)want, &readsize, 0))
+      {
+        if(GetLastError() == ERROR_BROKEN_PIPE) break; /*end of a pipe*/
+        lodepng_free(data);
+        return 78;
+      }
+    }
+#else
+    readsize = read(file, data + size, allocsize - size);
+    if(readsize < 0)
+    {
+      if(errno == EINTR) continue;
+      lodepng_free(data);
+      return 78;
+    }
+#endif
+    if(readsize == 0) break;
+    size += (size_t)readsize;
+  }
+  view->data = data;
+  view->size = size;
+  view->mapped = 0;
+  return 0;
+}
+
+unsigned lodepng_view_file(LodePNGFileView* view, const char* filename)
+{
+  unsigned error = 0;
+#ifdef _WIN32
+  HANDLE file;
+  LARGE_INTEGER size;
+#else
+  int file;
+  struct stat st;
+#endif
+  view->data = 0;
+  view->size = 0;
+  view->mapped = 0;
+
+#ifdef _WIN32
+  file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+  if(file == INVALID_HANDLE_VALUE) return 78;
+  if(GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size) && size.QuadPart > 0
+     && (unsigned long long)size.QuadPart <= (size_t)(-1))
+  {
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    if(mapping)
+    {
+      /*the view keeps the mapping alive after both handles are closed*/
+      view->data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+    if(view->data)
+    {
+      view->size = (size_t)size.QuadPart;
+      view->mapped = 1;
+    }
+  }
+  if(!view->mapped) error = lodepng_read_rest(view, file);
+  CloseHandle(file);
+#else
+  file = open(filename, O_RDONLY);
+  if(file < 0) return 78;
+  if(fstat(file, &st) != 0 || S_ISDIR(st.st_mode)) error = 78;
+  else if(S_ISREG(st.st_mode) && st.st_size > 0 && (unsigned long long)st.st_size <= (size_t)(-1))
+  {
+    void* data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if(data != MAP_FAILED)
+    {
+#ifdef POSIX_MADV_SEQUENTIAL
+      posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+      view->data = (const unsigned char*)data;
+      view->size = (size_t)st.st_size;
+      view->mapped = 1;
+    }
+  }
+  /*pipes, empty or special files and failed maps are read the ordinary way*/
+  if(!error && !view->mapped) error = lodepng_read_rest(view, file);
+  close(file);
+#endif
+  return error;
+}
+
+void lodepng_file_view_cleanup(LodePNGFileView* view)
+{
+  if(view->mapped)
+  {
+#ifdef _WIN32
+    UnmapViewOfFile((LPCVOID)view->data);
+#else
+    munmap((void*)view->data, view->size);
+#endif
+  }
+  else lodepng_free((void*)view->data);
+  view->data = 0;
+  view->size = 0;
+  view->mapped = 0;
+}
+
 /*write given buffer to the file, overwriting the file, it doesn't append to it.*/
 unsigned lodepng_save_file(const unsigned char* buffer, size_t buffersize, const char* filename)
 {
@@ -442,23 +738,96 @@ static void addBitsToStreamReversed(size_t* bitpointer, ucvector* bitstream, uns
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-#define READBIT(bitpointer, bitstream) ((bitstream[bitpointer >> 3] >> (bitpointer & 0x7)) & (unsigned char)1)
+/*
+Reader for the bits of a deflate stream. Whole bytes are loaded into a 64-bit
+buffer up to 8 at a time, and bits are consumed from its least significant end
+with shifts. Bits past the end of the data read as 0, use bp and bitsize to
+check whether the end was passed.
+*/
+typedef struct LodePNGBitReader
+{
+  const unsigned char* data;
+  size_t size; /*size of data in bytes*/
+  size_t bitsize; /*size of data in bits*/
+  size_t bp; /*position of the next bit to consume, in bits*/
+  size_t loadpos; /*position of the next byte to load into the buffer*/
+  unsigned long long buffer; /*loaded bits that aren't consumed yet, next bit is the lsb*/
+  unsigned bufferbits; /*amount of valid bits in the buffer*/
+} LodePNGBitReader;
+
+static void LodePNGBitReader_init(LodePNGBitReader* reader, const unsigned char* data, size_t size)
+{
+  reader->data = data;
+  reader->size = size;
+  reader->bitsize = size * 8;
+  reader->bp = 0;
+  reader->loadpos = 0;
+  reader->buffer = 0;
+  reader->bufferbits = 0;
+}
+
+/*move to a byte aligned bit position, dropping what was buffered*/
+static void LodePNGBitReader_seek(LodePNGBitReader* reader, size_t bp)
+{
+  reader->bp = bp;
+  reader->loadpos = bp >> 3;
+  reader->buffer = 0;
+  reader->bufferbits = 0;
+}
+
+/*make sure at least nbits (at most 56) bits are in the buffer*/
+static void ensureBits(LodePNGBitReader* reader, unsigned nbits)
+{
+  if(reader->bufferbits >= nbits) return;
+  if(reader->loadpos + 8 <= reader->size)
+  {
+    const unsigned char* p = reader->data + reader->loadpos;
+    unsigned long long word = (unsigned long long)p[0]
+                            | ((unsigned long long)p[1] << 8u)
+                            | ((unsigned long long)p[2] << 16u)
+                            | ((unsigned long long)p[3] << 24u)
+                            | ((unsigned long long)p[4] << 32u)
+                            | ((unsigned long long)p[5] << 40u)
+                            | ((unsigned long long)p[6] << 48u)
+                            | ((unsigned long long)p[7] << 56u);
+    /*only the whole bytes that fit next to the buffered bits count as loaded*/
+    unsigned numbytes = (63u - reader->bufferbits) >> 3u;
+    reader->buffer |= word << reader->bufferbits;
+    reader->loadpos += numbytes;
+    reader->bufferbits += numbytes * 8u;
+  }
+  else
+  {
+    /*near the end, load byte by byte and pad with zeros*/
+    while(reader->bufferbits <= 56u)
+    {
+      unsigned long long byte = reader->loadpos < reader->size ? reader->data[reader->loadpos] : 0u;
+      reader->buffer |= byte << reader->bufferbits;
+      ++reader->loadpos;
+      reader->bufferbits += 8u;
+    }
+  }
+}
 
-static unsigned char readBitFromStream(size_t* bitpointer, const unsigned char* bitstream)
+/*get the next nbits (at most 32) bits without consuming them, ensureBits must have loaded them*/
+static unsigned peekBits(const LodePNGBitReader* reader, unsigned nbits)
 {
-  unsigned char result = (unsigned char)(READBIT(*bitpointer, bitstream));
-  ++(*bitpointer);
-  return result;
+  return (unsigned)(reader->buffer & ((1ull << nbits) - 1u));
 }
 
-static unsigned readBitsFromStream(size_t* bitpointer, const unsigned char* bitstream, size_t nbits)
+/*consume nbits bits, ensureBits must have loaded them*/
+static void advanceBits(LodePNGBitReader* reader, unsigned nbits)
 {
-  unsigned result = 0, i;
-  for(i = 0; i != nbits; ++i)
-  {
-    result += ((unsigned)READBIT(*bitpointer, bitstream)) << i;
-    ++(*bitpointer);
-  }
+  reader->buffer >>= nbits;
+  reader->bufferbits -= nbits;
+  reader->bp += nbits;
+}
+
+/*read nbits bits (at most 32), ensureBits must have loaded them*/
+static unsigned readBits(LodePNGBitReader* reader, unsigned nbits)
+{
+  unsigned result = peekBits(reader, nbits);
+  advanceBits(reader, nbits);
   return result;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
@@ -508,11 +877,13 @@ Huffman tree struct, containing multiple representations of the tree
 */
 typedef struct HuffmanTree
 {
-  unsigned* tree2d;
   unsigned* tree1d;
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  /*lookup table used by the decoder, see HuffmanTree_makeTable*/
+  unsigned char* table_len; /*length of the symbol, or of the secondary table index for long codes*/
+  unsigned short* table_value; /*the symbol, or where the secondary table starts for long codes*/
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -530,74 +901,143 @@ static void HuffmanTree_draw(HuffmanTree* tree)
 
 static void HuffmanTree_init(HuffmanTree* tree)
 {
-  tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table_len = 0;
+  tree->table_value = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
 {
-  lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table_len);
+  lodepng_free(tree->table_value);
 }
 
-/*the tree representation used by the decoder. return value is error*/
-static unsigned HuffmanTree_make2DTree(HuffmanTree* tree)
+/*amount of bits looked up at once in the first level of the decoding table*/
+#define FIRSTBITS 9u
+
+/*symbol value used in the decoding table for bit patterns that are not a code*/
+#define INVALIDSYMBOL 65535u
+
+/*reverse the order of the lowest num bits of bits*/
+static unsigned reverseBits(unsigned bits, unsigned num)
 {
-  unsigned nodefilled = 0; /*up to which node it is filled*/
-  unsigned treepos = 0; /*position in the tree (1 of the numcodes columns)*/
-  unsigned n, i;
+  unsigned i, result = 0;
+  for(i = 0; i < num; ++i) result |= ((bits >> (num - i - 1)) & 1u) << i;
+  return result;
+}
 
-  tree->tree2d = (unsigned*)lodepng_malloc(tree->numcodes * 2 * sizeof(unsigned));
-  if(!tree->tree2d) return 83; /*alloc fail*/
+/*
+the decoding table used by the decoder. return value is error.
+The first FIRSTBITS bits of the input index the first table. Codes of at most
+FIRSTBITS bits are decoded from there directly, the entry is repeated for all
+the bit patterns that follow them. For longer codes the entry holds the total
+length of the longest code with that prefix and where its secondary table
+starts, which is then indexed with the remaining bits.
+The codes are stored with the bits reversed, because deflate stores them
+starting from the most significant bit while they are read from the least
+significant bit of each byte.
+*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree)
+{
+  static const unsigned headsize = 1u << FIRSTBITS; /*size of the first table*/
+  static const unsigned mask = (1u << FIRSTBITS) - 1u;
+  size_t i, pointer, size; /*size is the total table size*/
+  unsigned* maxlens = (unsigned*)lodepng_malloc(headsize * sizeof(unsigned));
+  if(!maxlens) return 83; /*alloc fail*/
 
-  /*
-  convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
-  uninited, a value >= numcodes is an address to another bit, a value < numcodes
-  is a code. The 2 rows are the 2 possible bit values (0 or 1), there are as
-  many columns as codes - 1.
-  A good huffman tree has N * 2 - 1 nodes, of which N - 1 are internal nodes.
-  Here, the internal nodes are stored (what their 0 and 1 option point to).
-  There is only memory for such good tree currently, if there are more nodes
-  (due to too long length codes), error 55 will happen
-  */
-  for(n = 0; n < tree->numcodes * 2; ++n)
+  /*max total bit length of the codes sharing each prefix of the first table*/
+  for(i = 0; i != headsize; ++i) maxlens[i] = 0;
+  for(i = 0; i != tree->numcodes; ++i)
+  {
+    unsigned l = tree->lengths[i];
+    unsigned index;
+    if(l <= FIRSTBITS) continue; /*codes that fit in the first table don't need a secondary one*/
+    index = reverseBits(tree->tree1d[i] >> (l - FIRSTBITS), FIRSTBITS);
+    if(maxlens[index] < l) maxlens[index] = l;
+  }
+
+  size = headsize;
+  for(i = 0; i != headsize; ++i)
+  {
+    if(maxlens[i] > FIRSTBITS) size += (1u << (maxlens[i] - FIRSTBITS));
+  }
+
+  tree->table_len = (unsigned char*)lodepng_malloc(size * sizeof(unsigned char));
+  tree->table_value = (unsigned short*)lodepng_malloc(size * sizeof(unsigned short));
+  if(!tree->table_len || !tree->table_value)
   {
-    tree->tree2d[n] = 32767; /*32767 here means the tree2d isn't filled there yet*/
+    lodepng_free(maxlens);
+    return 83; /*alloc fail*/
+  }
+
+  /*16 marks an entry that isn't filled in yet, codes are at most 15 bits*/
+  for(i = 0; i != size; ++i) tree->table_len[i] = 16;
+
+  /*first table entries of long codes point to their secondary table*/
+  pointer = headsize;
+  for(i = 0; i != headsize; ++i)
+  {
+    unsigned l = maxlens[i];
+    if(l <= FIRSTBITS) continue;
+    tree->table_len[i] = (unsigned char)l;
+    tree->table_value[i] = (unsigned short)pointer;
+    pointer += (1u << (l - FIRSTBITS));
   }
+  lodepng_free(maxlens);
 
-  for(n = 0; n < tree->numcodes; ++n) /*the codes*/
+  for(i = 0; i != tree->numcodes; ++i)
   {
-    for(i = 0; i != tree->lengths[n]; ++i) /*the bits for this code*/
+    unsigned l = tree->lengths[i];
+    unsigned reverse, j;
+    if(l == 0) continue;
+    reverse = reverseBits(tree->tree1d[i], l);
+
+    if(l <= FIRSTBITS)
     {
-      unsigned char bit = (unsigned char)((tree->tree1d[n] >> (tree->lengths[n] - i - 1)) & 1);
-      /*oversubscribed, see comment in lodepng_error_text*/
-      if(treepos > 2147483647 || treepos + 2 > tree->numcodes) return 55;
-      if(tree->tree2d[2 * treepos + bit] == 32767) /*not yet filled in*/
+      /*short code, fully in the first table, repeated for every value of the bits that follow it*/
+      unsigned num = 1u << (FIRSTBITS - l);
+      for(j = 0; j != num; ++j)
       {
-        if(i + 1 == tree->lengths[n]) /*last bit*/
-        {
-          tree->tree2d[2 * treepos + bit] = n; /*put the current code in it*/
-          treepos = 0;
-        }
-        else
-        {
-          /*put address of the next step in here, first that address has to be found of course
-          (it's just nodefilled + 1)...*/
-          ++nodefilled;
-          /*addresses encoded with numcodes added to it*/
-          tree->tree2d[2 * treepos + bit] = nodefilled + tree->numcodes;
-          treepos = nodefilled;
-        }
+        unsigned index = reverse | (j << l);
+        if(tree->table_len[index] != 16) return 55; /*oversubscribed, see comment in lodepng_error_text*/
+        tree->table_len[index] = (unsigned char)l;
+        tree->table_value[index] = (unsigned short)i;
+      }
+    }
+    else
+    {
+      /*long code, the first FIRSTBITS bits select the secondary table, the rest index into it*/
+      unsigned index = reverse & mask;
+      unsigned maxlen = tree->table_len[index];
+      unsigned start = tree->table_value[index];
+      unsigned num;
+      if(maxlen < l || maxlen == 16) return 55; /*oversubscribed, a short code has the same prefix*/
+      num = 1u << (maxlen - l);
+      for(j = 0; j != num; ++j)
+      {
+        unsigned index2 = start + ((reverse >> FIRSTBITS) | (j << (l - FIRSTBITS)));
+        if(tree->table_len[index2] != 16) return 55; /*oversubscribed*/
+        tree->table_len[index2] = (unsigned char)l;
+        tree->table_value[index2] = (unsigned short)i;
       }
-      else treepos = tree->tree2d[2 * treepos + bit] - tree->numcodes;
     }
   }
 
-  for(n = 0; n < tree->numcodes * 2; ++n)
+  /*
+  Bit patterns that aren't a code (incomplete trees, or trees with only one or
+  no codes which deflate allows) decode to INVALIDSYMBOL. The length is chosen
+  so reading them never jumps past a secondary table.
+  */
+  for(i = 0; i != size; ++i)
   {
-    if(tree->tree2d[n] == 32767) tree->tree2d[n] = 0; /*remove possible remaining 32767's*/
+    if(tree->table_len[i] == 16)
+    {
+      tree->table_len[i] = (i < headsize) ? 1 : (FIRSTBITS + 1);
+      tree->table_value[i] = INVALIDSYMBOL;
+    }
   }
 
   return 0;
@@ -644,8 +1084,7 @@ static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
   uivector_cleanup(&blcount);
   uivector_cleanup(&nextcode);
 
-  if(!error) return HuffmanTree_make2DTree(tree);
-  else return error;
+  return error;
 }
 
 /*
@@ -662,7 +1101,8 @@ static unsigned HuffmanTree_makeFromLengths(HuffmanTree* tree, const unsigned* b
   for(i = 0; i != numcodes; ++i) tree->lengths[i] = bitlen[i];
   tree->numcodes = (unsigned)numcodes; /*number of symbols*/
   tree->maxbitlen = maxbitlen;
-  return HuffmanTree_makeFromLengths2(tree);
+  CERROR_TRY_RETURN(HuffmanTree_makeFromLengths2(tree));
+  return HuffmanTree_makeTable(tree);
 }
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -942,26 +1382,26 @@ static unsigned generateFixedDistanceTree(HuffmanTree* tree)
 
 /*
 returns the code, or (unsigned)(-1) if error happened
-inbitlength is the length of the complete buffer, in bits (so its byte length times 8)
+the caller must have used ensureBits so that at least 15 bits are buffered
 */
-static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
-                                    const HuffmanTree* codetree, size_t inbitlength)
+static unsigned huffmanDecodeSymbol(LodePNGBitReader* reader, const HuffmanTree* codetree)
 {
-  unsigned treepos = 0, ct;
-  for(;;)
+  /*look the symbol up in the decoding table, this is the biggest bottleneck while decoding*/
+  unsigned index = peekBits(reader, FIRSTBITS);
+  unsigned l = codetree->table_len[index];
+  unsigned value = codetree->table_value[index];
+  if(l > FIRSTBITS)
   {
-    if(*bp >= inbitlength) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
-    /*
-    decode the symbol from the tree. The "readBitFromStream" code is inlined in
-    the expression below because this is the biggest bottleneck while decoding
-    */
-    ct = codetree->tree2d[(treepos << 1) + READBIT(*bp, in)];
-    ++(*bp);
-    if(ct < codetree->numcodes) return ct; /*the symbol is decoded, return it*/
-    else treepos = ct - codetree->numcodes; /*symbol not yet decoded, instead move tree position*/
-
-    if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
+    /*long code, the rest of its bits index the secondary table*/
+    advanceBits(reader, FIRSTBITS);
+    index = value + peekBits(reader, l - FIRSTBITS);
+    l = codetree->table_len[index] - FIRSTBITS;
+    value = codetree->table_value[index];
   }
+  advanceBits(reader, l);
+  if(reader->bp > reader->bitsize) return (unsigned)(-1); /*error: end of input memory reached without endcode*/
+  if(value == INVALIDSYMBOL) return (unsigned)(-1); /*error: the bits are not a code of the codetree*/
+  return value;
 }
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -971,22 +1411,52 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
 /* / Inflator (Decompressor)                                                / */
 /* ////////////////////////////////////////////////////////////////////////// */
 
-/*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-static void getTreeInflateFixed(HuffmanTree* tree_ll, HuffmanTree* tree_d)
+/*
+The trees of deflated blocks with fixed tree, as specified in the deflate
+specification. They are the same for every such block, so they are built on
+first use and then shared by all of them, see LodePNGDecoderContext.
+*/
+typedef struct InflateFixedTrees
+{
+  HuffmanTree tree_ll, tree_d;
+  unsigned built;
+} InflateFixedTrees;
+
+static void InflateFixedTrees_init(InflateFixedTrees* fixed)
+{
+  HuffmanTree_init(&fixed->tree_ll);
+  HuffmanTree_init(&fixed->tree_d);
+  fixed->built = 0;
+}
+
+static void InflateFixedTrees_cleanup(InflateFixedTrees* fixed)
 {
-  /*TODO: check for out of memory errors*/
-  generateFixedLitLenTree(tree_ll);
-  generateFixedDistanceTree(tree_d);
+  HuffmanTree_cleanup(&fixed->tree_ll);
+  HuffmanTree_cleanup(&fixed->tree_d);
+}
+
+static unsigned InflateFixedTrees_build(InflateFixedTrees* fixed)
+{
+  unsigned error;
+  if(fixed->built) return 0;
+  error = generateFixedLitLenTree(&fixed->tree_ll);
+  if(!error) error = generateFixedDistanceTree(&fixed->tree_d);
+  fixed->built = !error;
+  if(error)
+  {
+    InflateFixedTrees_cleanup(fixed);
+    InflateFixedTrees_init(fixed);
+  }
+  return error;
 }
 
 /*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
 static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
-                                      const unsigned char* in, size_t* bp, size_t inlength)
+                                      LodePNGBitReader* reader)
 {
   /*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
   unsigned error = 0;
   unsigned n, HLIT, HDIST, HCLEN, i;
-  size_t inbitlength = inlength * 8;
 
   /*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
   unsigned* bitlen_ll = 0; /*lit,len code lengths*/
@@ -995,16 +1465,17 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   unsigned* bitlen_cl = 0;
   HuffmanTree tree_cl; /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
 
-  if((*bp) + 14 > (inlength << 3)) return 49; /*error: the bit pointer is or will go past the memory*/
+  if(reader->bp + 14 > reader->bitsize) return 49; /*error: the bit pointer is or will go past the memory*/
 
+  ensureBits(reader, 14);
   /*number of literal/length codes + 257. Unlike the spec, the value 257 is added to it here already*/
-  HLIT =  readBitsFromStream(bp, in, 5) + 257;
+  HLIT =  readBits(reader, 5) + 257;
   /*number of distance codes. Unlike the spec, the value 1 is added to it here already*/
-  HDIST = readBitsFromStream(bp, in, 5) + 1;
+  HDIST = readBits(reader, 5) + 1;
   /*number of code length codes. Unlike the spec, the value 4 is added to it here already*/
-  HCLEN = readBitsFromStream(bp, in, 4) + 4;
+  HCLEN = readBits(reader, 4) + 4;
 
-  if((*bp) + HCLEN * 3 > (inlength << 3)) return 50; /*error: the bit pointer is or will go past the memory*/
+  if(reader->bp + HCLEN * 3 > reader->bitsize) return 50; /*error: the bit pointer is or will go past the memory*/
 
   HuffmanTree_init(&tree_cl);
 
@@ -1017,7 +1488,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
     for(i = 0; i != NUM_CODE_LENGTH_CODES; ++i)
     {
-      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream(bp, in, 3);
+      ensureBits(reader, 3);
+      if(i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBits(reader, 3);
       else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
     }
 
@@ -1035,7 +1507,9 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
     i = 0;
     while(i < HLIT + HDIST)
     {
-      unsigned code = huffmanDecodeSymbol(in, bp, &tree_cl, inbitlength);
+      unsigned code;
+      ensureBits(reader, 14); /*up to 7 bits for the code and 7 for its repeat length*/
+      code = huffmanDecodeSymbol(reader, &tree_cl);
       if(code <= 15) /*a length code*/
       {
         if(i < HLIT) bitlen_ll[i] = code;
@@ -1049,8 +1523,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
 
         if(i == 0) ERROR_BREAK(54); /*can't repeat previous if i is 0*/
 
-        if((*bp + 2) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 2);
+        if((reader->bp + 2) > reader->bitsize) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 2);
 
         if(i < HLIT + 1) value = bitlen_ll[i - 1];
         else value = bitlen_d[i - HLIT - 1];
@@ -1066,8 +1540,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 17) /*repeat "0" 3-10 times*/
       {
         unsigned replength = 3; /*read in the bits that indicate repeat length*/
-        if((*bp + 3) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 3);
+        if((reader->bp + 3) > reader->bitsize) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 3);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1082,8 +1556,8 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
       else if(code == 18) /*repeat "0" 11-138 times*/
       {
         unsigned replength = 11; /*read in the bits that indicate repeat length*/
-        if((*bp + 7) > inbitlength) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
-        replength += readBitsFromStream(bp, in, 7);
+        if((reader->bp + 7) > reader->bitsize) ERROR_BREAK(50); /*error, bit pointer jumps past memory*/
+        replength += readBits(reader, 7);
 
         /*repeat this value in the next lengths*/
         for(n = 0; n < replength; ++n)
@@ -1101,7 +1575,7 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inbitlength ? 10 : 11;
+          error = reader->bp > reader->bitsize ? 10 : 11;
         }
         else error = 16; /*unexisting code, this can never happen*/
         break;
@@ -1127,29 +1601,86 @@ static unsigned getTreeInflateDynamic(HuffmanTree* tree_ll, HuffmanTree* tree_d,
   return error;
 }
 
-/*inflate a block with dynamic of fixed Huffman tree*/
-static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size_t* bp,
-                                    size_t* pos, size_t inlength, unsigned btype)
+/*
+copy length bytes that start distance bytes before dst to dst, for the case
+distance < length where the source overlaps the bytes being written. This is
+how deflate expresses runs (distance 1 for a repeated byte, 4 for a repeated
+RGBA pixel, ...), so it's done in chunks of 16 or 8 bytes rather than per byte.
+*/
+static void copyOverlappingMatch(unsigned char* dst, size_t distance, size_t length)
 {
-  unsigned error = 0;
-  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
-  HuffmanTree tree_d; /*the huffman tree for distance codes*/
-  size_t inbitlength = inlength * 8;
+  const unsigned char* src = dst - distance;
+  unsigned char* end = dst + length;
 
-  HuffmanTree_init(&tree_ll);
-  HuffmanTree_init(&tree_d);
+  if(distance == 1)
+  {
+    memset(dst, *src, length);
+    return;
+  }
+
+  if(distance >= 16)
+  {
+    /*a chunk never reads bytes the same chunk writes*/
+    while(end - dst >= 16)
+    {
+      memcpy(dst, src, 16);
+      dst += 16;
+      src += 16;
+    }
+  }
+  else if(distance >= 8)
+  {
+    while(end - dst >= 8)
+    {
+      memcpy(dst, src, 8);
+      dst += 8;
+      src += 8;
+    }
+  }
+  else
+  {
+    /*
+    short distance: repeat the distance bytes into an 8 byte pattern, and advance
+    by the largest multiple of distance that fits in 8 so the pattern stays in phase
+    */
+    unsigned char pattern[8];
+    size_t i, step = (8 / distance) * distance;
+    for(i = 0; i != 8; ++i) pattern[i] = src[i % distance];
+    while(end - dst >= 8)
+    {
+      memcpy(dst, pattern, 8);
+      dst += step;
+    }
+    src = dst - distance;
+  }
+
+  /*the remaining less than a chunk*/
+  while(dst != end) *dst++ = *src++;
+}
 
-  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
-  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+/*
+Decode the symbols of a Huffman block until its end code, or until the output
+reaches limit bytes (it may overshoot by one match, at most 258 bytes). *end
+is set to 1 if the end code was reached.
+*/
+static unsigned inflateHuffmanSymbols(ucvector* out, LodePNGBitReader* reader, size_t* pos,
+                                      const HuffmanTree* tree_ll, const HuffmanTree* tree_d,
+                                      size_t limit, unsigned* end)
+{
+  unsigned error = 0;
+  *end = 0;
 
-  while(!error) /*decode all symbols until end reached, breaks at end code*/
+  while(*pos < limit) /*decode all symbols until end reached, breaks at end code*/
   {
     /*code_ll is literal, length or end code*/
-    unsigned code_ll = huffmanDecodeSymbol(in, bp, &tree_ll, inbitlength);
+    unsigned code_ll;
+    /*enough bits for the longest length code, distance code and their extra bits*/
+    ensureBits(reader, 15 + 5 + 15 + 13);
+    code_ll = huffmanDecodeSymbol(reader, tree_ll);
     if(code_ll <= 255) /*literal symbol*/
     {
-      /*ucvector_push_back would do the same, but for some reason the two lines below run 10% faster*/
-      if(!ucvector_resize(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
+      /*only grows if the output is larger than reserved, out->size is updated at the end of the block*/
+      if((*pos) >= out->allocsize && !ucvector_reserve(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
       out->data[*pos] = (unsigned char)code_ll;
       ++(*pos);
     }
@@ -1157,25 +1688,25 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
     {
       unsigned code_d, distance;
       unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
-      size_t start, forward, backward, length;
+      size_t start, backward, length;
 
       /*part 1: get length base*/
       length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
 
       /*part 2: get extra bits and add the value of that to length*/
       numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
-      if((*bp + numextrabits_l) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      length += readBitsFromStream(bp, in, numextrabits_l);
+      if((reader->bp + numextrabits_l) > reader->bitsize) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      length += readBits(reader, numextrabits_l);
 
       /*part 3: get distance code*/
-      code_d = huffmanDecodeSymbol(in, bp, &tree_d, inbitlength);
+      code_d = huffmanDecodeSymbol(reader, tree_d);
       if(code_d > 29)
       {
         if(code_d == (unsigned)(-1)) /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
         {
           /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
           (10=no endcode, 11=wrong jump outside of tree)*/
-          error = (*bp) > inlength * 8 ? 10 : 11;
+          error = reader->bp > reader->bitsize ? 10 : 11;
         }
         else error = 18; /*error: invalid distance code (30-31 are never used)*/
         break;
@@ -1184,52 +1715,78 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
 
       /*part 4: get extra bits from distance*/
       numextrabits_d = DISTANCEEXTRA[code_d];
-      if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
-      distance += readBitsFromStream(bp, in, numextrabits_d);
+      if((reader->bp + numextrabits_d) > reader->bitsize) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+      distance += readBits(reader, numextrabits_d);
 
       /*part 5: fill in all the out[n] values based on the length and dist*/
       start = (*pos);
       if(distance > start) ERROR_BREAK(52); /*too long backward distance*/
       backward = start - distance;
 
-      if(!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
+      if((*pos) + length > out->allocsize && !ucvector_reserve(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
       if (distance < length) {
-        for(forward = 0; forward < length; ++forward)
-        {
-          out->data[(*pos)++] = out->data[backward++];
-        }
+        copyOverlappingMatch(out->data + *pos, distance, length);
       } else {
         memcpy(out->data + *pos, out->data + backward, length);
-        *pos += length;
       }
+      *pos += length;
     }
     else if(code_ll == 256)
     {
+      *end = 1;
       break; /*end code, break the loop*/
     }
     else /*if(code == (unsigned)(-1))*/ /*huffmanDecodeSymbol returns (unsigned)(-1) in case of error*/
     {
       /*return error code 10 or 11 depending on the situation that happened in huffmanDecodeSymbol
       (10=no endcode, 11=wrong jump outside of tree)*/
-      error = ((*bp) > inlength * 8) ? 10 : 11;
+      error = (reader->bp > reader->bitsize) ? 10 : 11;
       break;
     }
   }
 
+  out->size = (*pos);
+
+  return error;
+}
+
+/*inflate a block with dynamic of fixed Huffman tree*/
+static unsigned inflateHuffmanBlock(ucvector* out, LodePNGBitReader* reader,
+                                    size_t* pos, unsigned btype, InflateFixedTrees* fixed)
+{
+  unsigned error = 0, end;
+  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
+  HuffmanTree tree_d; /*the huffman tree for distance codes*/
+
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+
+  if(btype == 1)
+  {
+    error = InflateFixedTrees_build(fixed);
+    if(!error) error = inflateHuffmanSymbols(out, reader, pos, &fixed->tree_ll, &fixed->tree_d, (size_t)(-1), &end);
+  }
+  else if(btype == 2)
+  {
+    error = getTreeInflateDynamic(&tree_ll, &tree_d, reader);
+    if(!error) error = inflateHuffmanSymbols(out, reader, pos, &tree_ll, &tree_d, (size_t)(-1), &end);
+  }
+
   HuffmanTree_cleanup(&tree_ll);
   HuffmanTree_cleanup(&tree_d);
 
   return error;
 }
 
-static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
+static unsigned inflateNoCompression(ucvector* out, LodePNGBitReader* reader, size_t* pos)
 {
   size_t p;
   unsigned LEN, NLEN, n, error = 0;
+  const unsigned char* in = reader->data;
+  size_t inlength = reader->size;
 
   /*go to first boundary of byte*/
-  while(((*bp) & 0x7) != 0) ++(*bp);
-  p = (*bp) / 8; /*byte position*/
+  p = (reader->bp + 7) / 8; /*byte position*/
 
   /*read LEN (2 bytes) and NLEN (2 bytes)*/
   if(p + 4 >= inlength) return 52; /*error, bit pointer will jump past memory*/
@@ -1245,38 +1802,46 @@ static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, siz
   if(p + LEN > inlength) return 23; /*error: reading outside of in buffer*/
   for(n = 0; n < LEN; ++n) out->data[(*pos)++] = in[p++];
 
-  (*bp) = p * 8;
+  LodePNGBitReader_seek(reader, p * 8);
 
   return error;
 }
 
+/*fixed: the fixed trees to share, or 0 to build them here when a block needs them*/
 static unsigned lodepng_inflatev(ucvector* out,
                                  const unsigned char* in, size_t insize,
-                                 const LodePNGDecompressSettings* settings)
+                                 const LodePNGDecompressSettings* settings,
+                                 InflateFixedTrees* fixed)
 {
-  /*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
-  size_t bp = 0;
+  /*bit reader over the "in" data, starting at its first bit*/
+  LodePNGBitReader reader;
   unsigned BFINAL = 0;
   size_t pos = 0; /*byte position in the out buffer*/
   unsigned error = 0;
+  InflateFixedTrees ownfixed;
 
   (void)settings;
 
+  LodePNGBitReader_init(&reader, in, insize);
+  InflateFixedTrees_init(&ownfixed);
+  if(!fixed) fixed = &ownfixed;
+
   while(!BFINAL)
   {
     unsigned BTYPE;
-    if(bp + 2 >= insize * 8) return 52; /*error, bit pointer will jump past memory*/
-    BFINAL = readBitFromStream(&bp, in);
-    BTYPE = 1u * readBitFromStream(&bp, in);
-    BTYPE += 2u * readBitFromStream(&bp, in);
+    if(reader.bp + 2 >= reader.bitsize) ERROR_BREAK(52); /*error, bit pointer will jump past memory*/
+    ensureBits(&reader, 3);
+    BFINAL = readBits(&reader, 1);
+    BTYPE = readBits(&reader, 2);
 
-    if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
-    else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
-    else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+    if(BTYPE == 3) error = 20; /*error: invalid BTYPE*/
+    else if(BTYPE == 0) error = inflateNoCompression(out, &reader, &pos); /*no compression*/
+    else error = inflateHuffmanBlock(out, &reader, &pos, BTYPE, fixed); /*compression, BTYPE 01 or 10*/
 
-    if(error) return error;
+    if(error) break;
   }
 
+  InflateFixedTrees_cleanup(&ownfixed);
   return error;
 }
 
@@ -1287,15 +1852,20 @@ unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
   unsigned error;
   ucvector v;
   ucvector_init_buffer(&v, *out, *outsize);
-  error = lodepng_inflatev(&v, in, insize, settings);
+  error = lodepng_inflatev(&v, in, insize, settings, 0);
   *out = v.data;
   *outsize = v.size;
   return error;
 }
 
-static unsigned inflate(unsigned char** out, size_t* outsize,
+/*
+expected_size is the decompressed size if known, or 0. The output buffer is
+then allocated once up front instead of growing while inflating.
+fixed is passed on to lodepng_inflatev.
+*/
+static unsigned inflate(unsigned char** out, size_t* outsize, size_t expected_size,
                         const unsigned char* in, size_t insize,
-                        const LodePNGDecompressSettings* settings)
+                        const LodePNGDecompressSettings* settings, InflateFixedTrees* fixed)
 {
   if(settings->custom_inflate)
   {
@@ -1303,7 +1873,14 @@ static unsigned inflate(unsigned char** out, size_t* outsize,
   }
   else
   {
-    return lodepng_inflate(out, outsize, in, insize, settings);
+    unsigned error;
+    ucvector v;
+    ucvector_init_buffer(&v, *out, *outsize);
+    if(expected_size && !ucvector_reserve(&v, expected_size)) return 83; /*alloc fail*/
+    error = lodepng_inflatev(&v, in, insize, settings, fixed);
+    *out = v.data;
+    *outsize = v.size;
+    return error;
   }
 }
 
@@ -2088,10 +2665,120 @@ static unsigned deflate(unsigned char** out, size_t* outsize,
 /* / Adler32                                                                  */
 /* ////////////////////////////////////////////////////////////////////////// */
 
+#ifdef LODEPNG_COMPILE_X86_SIMD
+/*
+The SIMD kernels take a multiple of 32 bytes. For each 32-byte block, s2 grows by
+32 * (s1 before the block) plus the block's bytes weighted 32..1, and s1 by the
+plain byte sum. Up to 173 blocks (5536 bytes) fit in 32-bit lanes before the
+modulo, like the 5550-byte chunks of the scalar loop.
+*/
+__attribute__((target("ssse3")))
+static unsigned adler32_ssse3(unsigned adler, const unsigned char* data, unsigned len)
+{
+  const __m128i tap1 = _mm_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17);
+  const __m128i tap2 = _mm_setr_epi8(16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi16(1);
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / 32;
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > 173 ? 173 : blocks;
+    __m128i v_ps = _mm_cvtsi32_si128((int)(s1 * n));
+    __m128i v_s2 = _mm_cvtsi32_si128((int)s2);
+    __m128i v_s1 = zero;
+    blocks -= n;
+    while(n > 0)
+    {
+      const __m128i bytes1 = _mm_loadu_si128((const __m128i*)data);
+      const __m128i bytes2 = _mm_loadu_si128((const __m128i*)(data + 16));
+      v_ps = _mm_add_epi32(v_ps, v_s1);
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes1, zero));
+      v_s1 = _mm_add_epi32(v_s1, _mm_sad_epu8(bytes2, zero));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes1, tap1), ones));
+      v_s2 = _mm_add_epi32(v_s2, _mm_madd_epi16(_mm_maddubs_epi16(bytes2, tap2), ones));
+      data += 32;
+      --n;
+    }
+    v_s2 = _mm_add_epi32(v_s2, _mm_slli_epi32(v_ps, 5));
+    v_s1 = _mm_add_epi32(v_s1, _mm_shuffle_epi32(v_s1, _MM_SHUFFLE(1, 0, 3, 2)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(1, 0, 3, 2)));
+    v_s2 = _mm_add_epi32(v_s2, _mm_shuffle_epi32(v_s2, _MM_SHUFFLE(2, 3, 0, 1)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(v_s1)) % 65521;
+    s2 = (unsigned)_mm_cvtsi128_si32(v_s2) % 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+
+#ifdef LODEPNG_COMPILE_X86_AVX2
+__attribute__((target("avx2")))
+static unsigned adler32_avx2(unsigned adler, const unsigned char* data, unsigned len)
+{
+  const __m256i tap = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                       16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi16(1);
+  unsigned s1 = adler & 0xffff;
+  unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned blocks = len / 32;
+
+  while(blocks > 0)
+  {
+    unsigned n = blocks > 173 ? 173 : blocks;
+    __m256i v_ps = _mm256_setr_epi32((int)(s1 * n), 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s2 = _mm256_setr_epi32((int)s2, 0, 0, 0, 0, 0, 0, 0);
+    __m256i v_s1 = zero;
+    __m128i sum1, sum2;
+    blocks -= n;
+    while(n > 0)
+    {
+      const __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+      v_ps = _mm256_add_epi32(v_ps, v_s1);
+      v_s1 = _mm256_add_epi32(v_s1, _mm256_sad_epu8(bytes, zero));
+      v_s2 = _mm256_add_epi32(v_s2, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, tap), ones));
+      data += 32;
+      --n;
+    }
+    v_s2 = _mm256_add_epi32(v_s2, _mm256_slli_epi32(v_ps, 5));
+    sum1 = _mm_add_epi32(_mm256_castsi256_si128(v_s1), _mm256_extracti128_si256(v_s1, 1));
+    sum2 = _mm_add_epi32(_mm256_castsi256_si128(v_s2), _mm256_extracti128_si256(v_s2, 1));
+    sum1 = _mm_add_epi32(sum1, _mm_shuffle_epi32(sum1, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum2 = _mm_add_epi32(sum2, _mm_shuffle_epi32(sum2, _MM_SHUFFLE(2, 3, 0, 1)));
+    s1 = (s1 + (unsigned)_mm_cvtsi128_si32(sum1)) % 65521;
+    s2 = (unsigned)_mm_cvtsi128_si32(sum2) % 65521;
+  }
+
+  return (s2 << 16) | s1;
+}
+#endif /*LODEPNG_COMPILE_X86_AVX2*/
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+
 static unsigned update_adler32(unsigned adler, const unsigned char* data, unsigned len)
 {
-   unsigned s1 = adler & 0xffff;
-   unsigned s2 = (adler >> 16) & 0xffff;
+  unsigned s1, s2;
+
+#ifdef LODEPNG_COMPILE_X86_SIMD
+  if(len >= 64)
+  {
+    unsigned features = lodepng_cpu_features();
+    unsigned blocks = len & ~31u;
+#ifdef LODEPNG_COMPILE_X86_AVX2
+    if(features & LODEPNG_CPU_AVX2) adler = adler32_avx2(adler, data, blocks);
+    else
+#endif /*LODEPNG_COMPILE_X86_AVX2*/
+    if(features & LODEPNG_CPU_SSSE3) adler = adler32_ssse3(adler, data, blocks);
+    else blocks = 0;
+    data += blocks;
+    len -= blocks;
+  }
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+
+  s1 = adler & 0xffff;
+  s2 = (adler >> 16) & 0xffff;
 
   while(len > 0)
   {
@@ -2123,10 +2810,9 @@ static unsigned adler32(const unsigned char* data, unsigned len)
 
 #ifdef LODEPNG_COMPILE_DECODER
 
-unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                 size_t insize, const LodePNGDecompressSettings* settings)
+/*checks the 2-byte zlib header, returns an error code if it isn't usable for PNG*/
+static unsigned zlib_checkHeader(const unsigned char* in, size_t insize)
 {
-  unsigned error = 0;
   unsigned CM, CINFO, FDICT;
 
   if(insize < 2) return 53; /*error, size of zlib data too small*/
@@ -2154,8 +2840,17 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
       "The additional flags shall not specify a preset dictionary."*/
     return 26;
   }
+  return 0;
+}
+
+static unsigned zlib_decompressv(unsigned char** out, size_t* outsize, size_t expected_size,
+                                 const unsigned char* in, size_t insize,
+                                 const LodePNGDecompressSettings* settings, InflateFixedTrees* fixed)
+{
+  unsigned error = zlib_checkHeader(in, insize);
+  if(error) return error;
 
-  error = inflate(out, outsize, in + 2, insize - 2, settings);
+  error = inflate(out, outsize, expected_size, in + 2, insize - 2, settings, fixed);
   if(error) return error;
 
   if(!settings->ignore_adler32)
@@ -2168,8 +2863,16 @@ unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const uns
   return 0; /*no error*/
 }
 
-static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                size_t insize, const LodePNGDecompressSettings* settings)
+unsigned lodepng_zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
+                                 size_t insize, const LodePNGDecompressSettings* settings)
+{
+  return zlib_decompressv(out, outsize, 0, in, insize, settings, 0);
+}
+
+/*expected_size is the decompressed size if known, or 0, see inflate, and so is fixed*/
+static unsigned zlib_decompress(unsigned char** out, size_t* outsize, size_t expected_size,
+                                const unsigned char* in, size_t insize,
+                                const LodePNGDecompressSettings* settings, InflateFixedTrees* fixed)
 {
   if(settings->custom_zlib)
   {
@@ -2177,7 +2880,7 @@ static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsi
   }
   else
   {
-    return lodepng_zlib_decompress(out, outsize, in, insize, settings);
+    return zlib_decompressv(out, outsize, expected_size, in, insize, settings, fixed);
   }
 }
 
@@ -2245,9 +2948,14 @@ static unsigned zlib_compress(unsigned char** out, size_t* outsize, const unsign
 #else /*no LODEPNG_COMPILE_ZLIB*/
 
 #ifdef LODEPNG_COMPILE_DECODER
-static unsigned zlib_decompress(unsigned char** out, size_t* outsize, const unsigned char* in,
-                                size_t insize, const LodePNGDecompressSettings* settings)
+typedef struct InflateFixedTrees InflateFixedTrees; /*only defined with the inflater*/
+
+static unsigned zlib_decompress(unsigned char** out, size_t* outsize, size_t expected_size,
+                                const unsigned char* in, size_t insize,
+                                const LodePNGDecompressSettings* settings, InflateFixedTrees* fixed)
 {
+  (void)expected_size;
+  (void)fixed;
   if(!settings->custom_zlib) return 87; /*no custom zlib function provided */
   return settings->custom_zlib(out, outsize, in, insize, settings);
 }
@@ -2319,52 +3027,403 @@ const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0,
 
 
 #ifndef LODEPNG_NO_COMPILE_CRC
-/* CRC polynomial: 0xedb88320 */
-static unsigned lodepng_crc32_table[256] = {
-           0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
-   249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
-   498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
-   325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
-   997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
-   901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
-   651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
-   671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
-  1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
-  2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
-  1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
-  1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
-  1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
-  1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
-  1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
-  1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
-  3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
-  3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
-  4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
-  4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
-  3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
-  3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
-  3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
-  3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
-  2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
-  2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
-  2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
-  2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
-  2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
-  2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
-  3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
-  3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+/* CRC polynomial: 0xedb88320. Row k holds the CRC of a byte followed by k zero
+bytes, so eight input bytes can be folded in per step (slicing-by-8). */
+static const unsigned lodepng_crc32_table[8][256] = {
+  {
+             0u, 1996959894u, 3993919788u, 2567524794u,  124634137u, 1886057615u, 3915621685u, 2657392035u,
+     249268274u, 2044508324u, 3772115230u, 2547177864u,  162941995u, 2125561021u, 3887607047u, 2428444049u,
+     498536548u, 1789927666u, 4089016648u, 2227061214u,  450548861u, 1843258603u, 4107580753u, 2211677639u,
+     325883990u, 1684777152u, 4251122042u, 2321926636u,  335633487u, 1661365465u, 4195302755u, 2366115317u,
+     997073096u, 1281953886u, 3579855332u, 2724688242u, 1006888145u, 1258607687u, 3524101629u, 2768942443u,
+     901097722u, 1119000684u, 3686517206u, 2898065728u,  853044451u, 1172266101u, 3705015759u, 2882616665u,
+     651767980u, 1373503546u, 3369554304u, 3218104598u,  565507253u, 1454621731u, 3485111705u, 3099436303u,
+     671266974u, 1594198024u, 3322730930u, 2970347812u,  795835527u, 1483230225u, 3244367275u, 3060149565u,
+    1994146192u,   31158534u, 2563907772u, 4023717930u, 1907459465u,  112637215u, 2680153253u, 3904427059u,
+    2013776290u,  251722036u, 2517215374u, 3775830040u, 2137656763u,  141376813u, 2439277719u, 3865271297u,
+    1802195444u,  476864866u, 2238001368u, 4066508878u, 1812370925u,  453092731u, 2181625025u, 4111451223u,
+    1706088902u,  314042704u, 2344532202u, 4240017532u, 1658658271u,  366619977u, 2362670323u, 4224994405u,
+    1303535960u,  984961486u, 2747007092u, 3569037538u, 1256170817u, 1037604311u, 2765210733u, 3554079995u,
+    1131014506u,  879679996u, 2909243462u, 3663771856u, 1141124467u,  855842277u, 2852801631u, 3708648649u,
+    1342533948u,  654459306u, 3188396048u, 3373015174u, 1466479909u,  544179635u, 3110523913u, 3462522015u,
+    1591671054u,  702138776u, 2966460450u, 3352799412u, 1504918807u,  783551873u, 3082640443u, 3233442989u,
+    3988292384u, 2596254646u,   62317068u, 1957810842u, 3939845945u, 2647816111u,   81470997u, 1943803523u,
+    3814918930u, 2489596804u,  225274430u, 2053790376u, 3826175755u, 2466906013u,  167816743u, 2097651377u,
+    4027552580u, 2265490386u,  503444072u, 1762050814u, 4150417245u, 2154129355u,  426522225u, 1852507879u,
+    4275313526u, 2312317920u,  282753626u, 1742555852u, 4189708143u, 2394877945u,  397917763u, 1622183637u,
+    3604390888u, 2714866558u,  953729732u, 1340076626u, 3518719985u, 2797360999u, 1068828381u, 1219638859u,
+    3624741850u, 2936675148u,  906185462u, 1090812512u, 3747672003u, 2825379669u,  829329135u, 1181335161u,
+    3412177804u, 3160834842u,  628085408u, 1382605366u, 3423369109u, 3138078467u,  570562233u, 1426400815u,
+    3317316542u, 2998733608u,  733239954u, 1555261956u, 3268935591u, 3050360625u,  752459403u, 1541320221u,
+    2607071920u, 3965973030u, 1969922972u,   40735498u, 2617837225u, 3943577151u, 1913087877u,   83908371u,
+    2512341634u, 3803740692u, 2075208622u,  213261112u, 2463272603u, 3855990285u, 2094854071u,  198958881u,
+    2262029012u, 4057260610u, 1759359992u,  534414190u, 2176718541u, 4139329115u, 1873836001u,  414664567u,
+    2282248934u, 4279200368u, 1711684554u,  285281116u, 2405801727u, 4167216745u, 1634467795u,  376229701u,
+    2685067896u, 3608007406u, 1308918612u,  956543938u, 2808555105u, 3495958263u, 1231636301u, 1047427035u,
+    2932959818u, 3654703836u, 1088359270u,  936918000u, 2847714899u, 3736837829u, 1202900863u,  817233897u,
+    3183342108u, 3401237130u, 1404277552u,  615818150u, 3134207493u, 3453421203u, 1423857449u,  601450431u,
+    3009837614u, 3294710456u, 1567103746u,  711928724u, 3020668471u, 3272380065u, 1510334235u,  755167117u
+  },
+  {
+             0u,  421212481u,  842424962u,  724390851u, 1684849924u, 2105013317u, 1448781702u, 1329698503u,
+    3369699848u, 3519200073u, 4210026634u, 3824474571u, 2897563404u, 3048111693u, 2659397006u, 2274893007u,
+    1254232657u, 1406739216u, 2029285587u, 1643069842u,  783210325u,  934667796u,  479770071u,   92505238u,
+    2182846553u, 2600511768u, 2955803355u, 2838940570u, 3866582365u, 4285295644u, 3561045983u, 3445231262u,
+    2508465314u, 2359236067u, 2813478432u, 3198777185u, 4058571174u, 3908292839u, 3286139684u, 3670389349u,
+    1566420650u, 1145479147u, 1869335592u, 1987116393u,  959540142u,  539646703u,  185010476u,  303839341u,
+    3745920755u, 3327985586u, 3983561841u, 4100678960u, 3140154359u, 2721170102u, 2300350837u, 2416418868u,
+     396344571u,  243568058u,  631889529u, 1018359608u, 1945336319u, 1793607870u, 1103436669u, 1490954812u,
+    4034481925u, 3915546180u, 3259968903u, 3679722694u, 2484439553u, 2366552896u, 2787371139u, 3208174018u,
+     950060301u,  565965900u,  177645455u,  328046286u, 1556873225u, 1171730760u, 1861902987u, 2011255754u,
+    3132841300u, 2745199637u, 2290958294u, 2442530455u, 3738671184u, 3352078609u, 3974232786u, 4126854035u,
+    1919080284u, 1803150877u, 1079293406u, 1498383519u,  370020952u,  253043481u,  607678682u, 1025720731u,
+    1711106983u, 2095471334u, 1472923941u, 1322268772u,   26324643u,  411738082u,  866634785u,  717028704u,
+    2904875439u, 3024081134u, 2668790573u, 2248782444u, 3376948395u, 3495106026u, 4219356713u, 3798300520u,
+     792689142u,  908347575u,  487136116u,   68299317u, 1263779058u, 1380486579u, 2036719216u, 1618931505u,
+    3890672638u, 4278043327u, 3587215740u, 3435896893u, 2206873338u, 2593195963u, 2981909624u, 2829542713u,
+     998479947u,  580430090u,  162921161u,  279890824u, 1609522511u, 1190423566u, 1842954189u, 1958874764u,
+    4082766403u, 3930137346u, 3245109441u, 3631694208u, 2536953671u, 2385372678u, 2768287173u, 3155920004u,
+    1900120602u, 1750776667u, 1131931800u, 1517083097u,  355290910u,  204897887u,  656092572u, 1040194781u,
+    3113746450u, 2692952403u, 2343461520u, 2461357009u, 3723805974u, 3304059991u, 4022511508u, 4141455061u,
+    2919742697u, 3072101800u, 2620513899u, 2234183466u, 3396041197u, 3547351212u, 4166851439u, 3779471918u,
+    1725839073u, 2143618976u, 1424512099u, 1307796770u,   45282277u,  464110244u,  813994343u,  698327078u,
+    3838160568u, 4259225593u, 3606301754u, 3488152955u, 2158586812u, 2578602749u, 2996767038u, 2877569151u,
+     740041904u,  889656817u,  506086962u,  120682355u, 1215357364u, 1366020341u, 2051441462u, 1667084919u,
+    3422213966u, 3538019855u, 4190942668u, 3772220557u, 2945847882u, 3062702859u, 2644537544u, 2226864521u,
+      52649286u,  439905287u,  823476164u,  672009861u, 1733269570u, 2119477507u, 1434057408u, 1281543041u,
+    2167981343u, 2552493150u, 3004082077u, 2853541596u, 3847487515u, 4233048410u, 3613549209u, 3464057816u,
+    1239502615u, 1358593622u, 2077699477u, 1657543892u,  764250643u,  882293586u,  532408465u,  111204816u,
+    1585378284u, 1197851309u, 1816695150u, 1968414767u,  974272232u,  587794345u,  136598634u,  289367339u,
+    2527558116u, 2411481253u, 2760973158u, 3179948583u, 4073438432u, 3956313505u, 3237863010u, 3655790371u,
+     347922877u,  229101820u,  646611775u, 1066513022u, 1892689081u, 1774917112u, 1122387515u, 1543337850u,
+    3697634229u, 3313392372u, 3998419255u, 4148705398u, 3087642289u, 2702352368u, 2319436851u, 2468674930u
+  },
+  {
+             0u,   29518391u,   59036782u,   38190681u,  118073564u,  114017003u,   76381362u,   89069189u,
+     236147128u,  265370511u,  228034006u,  206958561u,  152762724u,  148411219u,  178138378u,  190596925u,
+     472294256u,  501532999u,  530741022u,  509615401u,  456068012u,  451764635u,  413917122u,  426358261u,
+     305525448u,  334993663u,  296822438u,  275991697u,  356276756u,  352202787u,  381193850u,  393929805u,
+     944588512u,  965684439u, 1003065998u,  973863097u, 1061482044u, 1049003019u, 1019230802u, 1023561829u,
+     912136024u,  933002607u,  903529270u,  874031361u,  827834244u,  815125939u,  852716522u,  856752605u,
+     611050896u,  631869351u,  669987326u,  640506825u,  593644876u,  580921211u,  551983394u,  556069653u,
+     712553512u,  733666847u,  704405574u,  675154545u,  762387700u,  749958851u,  787859610u,  792175277u,
+    1889177024u, 1901651959u, 1931368878u, 1927033753u, 2006131996u, 1985040171u, 1947726194u, 1976933189u,
+    2122964088u, 2135668303u, 2098006038u, 2093965857u, 2038461604u, 2017599123u, 2047123658u, 2076625661u,
+    1824272048u, 1836991623u, 1866005214u, 1861914857u, 1807058540u, 1786244187u, 1748062722u, 1777547317u,
+    1655668488u, 1668093247u, 1630251878u, 1625932113u, 1705433044u, 1684323811u, 1713505210u, 1742760333u,
+    1222101792u, 1226154263u, 1263738702u, 1251046777u, 1339974652u, 1310460363u, 1281013650u, 1301863845u,
+    1187289752u, 1191637167u, 1161842422u, 1149379777u, 1103966788u, 1074747507u, 1112139306u, 1133218845u,
+    1425107024u, 1429406311u, 1467333694u, 1454888457u, 1408811148u, 1379576507u, 1350309090u, 1371438805u,
+    1524775400u, 1528845279u, 1499917702u, 1487177649u, 1575719220u, 1546255107u, 1584350554u, 1605185389u,
+    3778354048u, 3774312887u, 3803303918u, 3816007129u, 3862737756u, 3892238699u, 3854067506u, 3833203973u,
+    4012263992u, 4007927823u, 3970080342u, 3982554209u, 3895452388u, 3924658387u, 3953866378u, 3932773565u,
+    4245928176u, 4241609415u, 4271336606u, 4283762345u, 4196012076u, 4225268251u, 4187931714u, 4166823541u,
+    4076923208u, 4072833919u, 4035198246u, 4047918865u, 4094247316u, 4123732899u, 4153251322u, 4132437965u,
+    3648544096u, 3636082519u, 3673983246u, 3678331705u, 3732010428u, 3753090955u, 3723829714u, 3694611429u,
+    3614117080u, 3601426159u, 3572488374u, 3576541825u, 3496125444u, 3516976691u, 3555094634u, 3525581405u,
+    3311336976u, 3298595879u, 3336186494u, 3340255305u, 3260503756u, 3281337595u, 3251864226u, 3222399125u,
+    3410866088u, 3398419871u, 3368647622u, 3372945905u, 3427010420u, 3448139075u, 3485520666u, 3456284973u,
+    2444203584u, 2423127159u, 2452308526u, 2481530905u, 2527477404u, 2539934891u, 2502093554u, 2497740997u,
+    2679949304u, 2659102159u, 2620920726u, 2650438049u, 2562027300u, 2574714131u, 2603727690u, 2599670141u,
+    2374579504u, 2353749767u, 2383274334u, 2412743529u, 2323684844u, 2336421851u, 2298759554u, 2294686645u,
+    2207933576u, 2186809023u, 2149495014u, 2178734801u, 2224278612u, 2236720739u, 2266437690u, 2262135309u,
+    2850214048u, 2820717207u, 2858812622u, 2879680249u, 2934667388u, 2938704459u, 2909776914u, 2897069605u,
+    2817622296u, 2788420399u, 2759153014u, 2780249921u, 2700618180u, 2704950259u, 2742877610u, 2730399645u,
+    3049550800u, 3020298727u, 3057690558u, 3078802825u, 2999835404u, 3004150075u, 2974355298u, 2961925461u,
+    3151438440u, 3121956959u, 3092510214u, 3113327665u, 3168701108u, 3172786307u, 3210370778u, 3197646061u
+  },
+  {
+             0u, 3099354981u, 2852767883u,  313896942u, 2405603159u,  937357362u,  627793884u, 2648127673u,
+    3316918511u, 2097696650u, 1874714724u, 3607201537u, 1255587768u, 4067088605u, 3772741427u, 1482887254u,
+    1343838111u, 3903140090u, 4195393300u, 1118632049u, 3749429448u, 1741137837u, 1970407491u, 3452858150u,
+    2511175536u,  756094997u, 1067759611u, 2266550430u,  449832999u, 2725482306u, 2965774508u,  142231497u,
+    2687676222u,  412010587u,  171665333u, 2995192016u,  793786473u, 2548850444u, 2237264098u, 1038456711u,
+    1703315409u, 3711623348u, 3482275674u, 1999841343u, 3940814982u, 1381529571u, 1089329165u, 4166106984u,
+    4029413537u, 1217896388u, 1512189994u, 3802027855u, 2135519222u, 3354724499u, 3577784189u, 1845280792u,
+     899665998u, 2367928107u, 2677414085u,  657096608u, 3137160985u,   37822588u,  284462994u, 2823350519u,
+    2601801789u,  598228824u,  824021174u, 2309093331u,  343330666u, 2898962447u, 3195996129u,  113467524u,
+    1587572946u, 3860600759u, 4104763481u, 1276501820u, 3519211397u, 1769898208u, 2076913422u, 3279374443u,
+    3406630818u, 1941006535u, 1627703081u, 3652755532u, 1148164341u, 4241751952u, 3999682686u, 1457141531u,
+     247015245u, 3053797416u, 2763059142u,  470583459u, 2178658330u,  963106687u,  735213713u, 2473467892u,
+     992409347u, 2207944806u, 2435792776u,  697522413u, 3024379988u,  217581361u,  508405983u, 2800865210u,
+    4271038444u, 1177467017u, 1419450215u, 3962007554u, 1911572667u, 3377213406u, 3690561584u, 1665525589u,
+    1799331996u, 3548628985u, 3241568279u, 2039091058u, 3831314379u, 1558270126u, 1314193216u, 4142438437u,
+    2928380019u,  372764438u,   75645176u, 3158189981u,  568925988u, 2572515393u, 2346768303u,  861712586u,
+    3982079547u, 1441124702u, 1196457648u, 4293663189u, 1648042348u, 3666298377u, 3358779879u, 1888390786u,
+     686661332u, 2421291441u, 2196002399u,  978858298u, 2811169155u,  523464422u,  226935048u, 3040519789u,
+    3175145892u,  100435649u,  390670639u, 2952089162u,  841119475u, 2325614998u, 2553003640u,  546822429u,
+    2029308235u, 3225988654u, 3539796416u, 1782671013u, 4153826844u, 1328167289u, 1570739863u, 3844338162u,
+    1298864389u, 4124540512u, 3882013070u, 1608431339u, 3255406162u, 2058742071u, 1744848601u, 3501990332u,
+    2296328682u,  811816591u,  584513889u, 2590678532u,  129869501u, 3204563416u, 2914283062u,  352848211u,
+     494030490u, 2781751807u, 3078325777u,  264757620u, 2450577869u,  715964072u,  941166918u, 2158327331u,
+    3636881013u, 1618608400u, 1926213374u, 3396585883u, 1470427426u, 4011365959u, 4255988137u, 1158766284u,
+    1984818694u, 3471935843u, 3695453837u, 1693991400u, 4180638033u, 1100160564u, 1395044826u, 3952793279u,
+    3019491049u,  189112716u,  435162722u, 2706139399u, 1016811966u, 2217162459u, 2526189877u,  774831696u,
+     643086745u, 2666061564u, 2354934034u,  887166583u, 2838900430u,  294275499u,   54519365u, 3145957664u,
+    3823145334u, 1532818963u, 1240029693u, 4048895640u, 1820460577u, 3560857924u, 3331051178u, 2117577167u,
+    3598663992u, 1858283101u, 2088143283u, 3301633750u, 1495127663u, 3785470218u, 4078182116u, 1269332353u,
+     332098007u, 2876706482u, 3116540252u,   25085497u, 2628386432u,  605395429u,  916469259u, 2384220526u,
+    2254837415u, 1054503362u,  745528876u, 2496903497u,  151290352u, 2981684885u, 2735556987u,  464596510u,
+    1137851976u, 4218313005u, 3923506883u, 1365741990u, 3434129695u, 1946996346u, 1723425172u, 3724871409u
+  },
+  {
+             0u, 1029712304u, 2059424608u, 1201699536u, 4118849216u, 3370159984u, 2403399072u, 2988497936u,
+     812665793u,  219177585u, 1253054625u, 2010132753u, 3320900865u, 4170237105u, 3207642721u, 2186319825u,
+    1625331586u, 1568718386u,  438355170u,  658566482u, 2506109250u, 2818578674u, 4020265506u, 3535817618u,
+    1351670851u, 1844508147u,  709922595u,  389064339u, 2769320579u, 2557498163u, 3754961379u, 3803185235u,
+    3250663172u, 4238411444u, 3137436772u, 2254525908u,  876710340u,  153198708u, 1317132964u, 1944187668u,
+    4054934725u, 3436268917u, 2339452837u, 3054575125u,   70369797u,  961670069u, 2129760613u, 1133623509u,
+    2703341702u, 2621542710u, 3689016294u, 3867263574u, 1419845190u, 1774270454u,  778128678u,  318858390u,
+    2438067015u, 2888948471u, 3952189479u, 3606153623u, 1691440519u, 1504803895u,  504432359u,  594620247u,
+    1492342857u, 1704161785u,  573770537u,  525542041u, 2910060169u, 2417219385u, 3618876905u, 3939730521u,
+    1753420680u, 1440954936u,  306397416u,  790849880u, 2634265928u, 2690882808u, 3888375336u, 3668168600u,
+     940822475u,   91481723u, 1121164459u, 2142483739u, 3448989963u, 4042473659u, 3075684971u, 2318603227u,
+     140739594u,  889433530u, 1923340138u, 1338244826u, 4259521226u, 3229813626u, 2267247018u, 3124975642u,
+    2570221389u, 2756861693u, 3824297005u, 3734113693u, 1823658381u, 1372780605u,  376603373u,  722643805u,
+    2839690380u, 2485261628u, 3548540908u, 4007806556u, 1556257356u, 1638052860u,  637716780u,  459464860u,
+    4191346895u, 3300051327u, 2199040943u, 3195181599u,  206718479u,  825388991u, 1989285231u, 1274166495u,
+    3382881038u, 4106388158u, 3009607790u, 2382549470u, 1008864718u,   21111934u, 1189240494u, 2072147742u,
+    2984685714u, 2357631266u, 3408323570u, 4131834434u, 1147541074u, 2030452706u, 1051084082u,   63335554u,
+    2174155603u, 3170292451u, 4216760371u, 3325460867u, 1947622803u, 1232499747u,  248909555u,  867575619u,
+    3506841360u, 3966111392u, 2881909872u, 2527485376u,  612794832u,  434546784u, 1581699760u, 1663499008u,
+    3782634705u, 3692447073u, 2612412337u, 2799048193u,  351717905u,  697754529u, 1849071985u, 1398190273u,
+    1881644950u, 1296545318u,  182963446u,  931652934u, 2242328918u, 3100053734u, 4284967478u, 3255255942u,
+    1079497815u, 2100821479u,  983009079u,  133672583u, 3050795671u, 2293717799u, 3474399735u, 4067887175u,
+     281479188u,  765927844u, 1778867060u, 1466397380u, 3846680276u, 3626469220u, 2676489652u, 2733102084u,
+     548881365u,  500656741u, 1517752501u, 1729575173u, 3577210133u, 3898068133u, 2952246901u, 2459410373u,
+    3910527195u, 3564487019u, 2480257979u, 2931134987u,  479546907u,  569730987u, 1716854139u, 1530213579u,
+    3647316762u, 3825568426u, 2745561210u, 2663766474u,  753206746u,  293940330u, 1445287610u, 1799716618u,
+    2314567513u, 3029685993u, 4080348217u, 3461678473u, 2088098201u, 1091956777u,  112560889u, 1003856713u,
+    3112514712u, 2229607720u, 3276105720u, 4263857736u, 1275433560u, 1902492648u,  918929720u,  195422344u,
+     685033439u,  364179055u, 1377080511u, 1869921551u, 3713294623u, 3761522863u, 2811507327u, 2599689167u,
+     413436958u,  633644462u, 1650777982u, 1594160846u, 3978570462u, 3494118254u, 2548332990u, 2860797966u,
+    1211387997u, 1968470509u,  854852413u,  261368461u, 3182753437u, 2161434413u, 3346310653u, 4195650637u,
+    2017729436u, 1160000044u,   42223868u, 1071931724u, 2378480988u, 2963576044u, 4144295484u, 3395602316u
+  },
+  {
+             0u, 3411858341u, 1304994059u, 2257875630u, 2609988118u, 1355649459u, 3596215069u,  486879416u,
+    3964895853u,  655315400u, 2711298918u, 1791488195u, 2009251963u, 3164476382u,  973758832u, 4048990933u,
+      64357019u, 3364540734u, 1310630800u, 2235723829u, 2554806413u, 1394316072u, 3582976390u,  517157411u,
+    4018503926u,  618222419u, 2722963965u, 1762783832u, 1947517664u, 3209171269u,  970744811u, 4068520014u,
+     128714038u, 3438335635u, 1248109629u, 2167961496u, 2621261600u, 1466012805u, 3522553387u,  447296910u,
+    3959392091u,  547575038u, 2788632144u, 1835791861u, 1886307661u, 3140622056u, 1034314822u, 4143626211u,
+      75106221u, 3475428360u, 1236444838u, 2196665603u, 2682996155u, 1421317662u, 3525567664u,  427767573u,
+    3895035328u,  594892389u, 2782995659u, 1857943406u, 1941489622u, 3101955187u, 1047553757u, 4113347960u,
+     257428076u, 3288652233u, 1116777319u, 2311878850u, 2496219258u, 1603640287u, 3640781169u,  308099796u,
+    3809183745u,  676813732u, 2932025610u, 1704983215u, 2023410199u, 3016104370u,  894593820u, 4262377657u,
+     210634999u, 3352484690u, 1095150076u, 2316991065u, 2535410401u, 1547934020u, 3671583722u,  294336591u,
+    3772615322u,  729897279u, 2903845777u, 1716123700u, 2068629644u, 2953845545u,  914647431u, 4258839074u,
+     150212442u, 3282623743u, 1161604689u, 2388688372u, 2472889676u, 1480171241u, 3735940167u,  368132066u,
+    3836185911u,  805002898u, 2842635324u, 1647574937u, 2134298401u, 3026852996u,  855535146u, 4188192143u,
+     186781121u, 3229539940u, 1189784778u, 2377547631u, 2427670487u, 1542429810u, 3715886812u,  371670393u,
+    3882979244u,  741170185u, 2864262823u, 1642462466u, 2095107514u, 3082559007u,  824732849u, 4201955092u,
+     514856152u, 3589064573u, 1400419795u, 2552522358u, 2233554638u, 1316849003u, 3370776517u,   62202976u,
+    4075001525u,  968836368u, 3207280574u, 1954014235u, 1769133219u, 2720925446u,  616199592u, 4024870413u,
+     493229635u, 3594175974u, 1353627464u, 2616354029u, 2264355925u, 1303087088u, 3409966430u,    6498043u,
+    4046820398u,  979978123u, 3170710821u, 2007099008u, 1789187640u, 2717386141u,  661419827u, 3962610838u,
+     421269998u, 3527459403u, 1423225061u, 2676515648u, 2190300152u, 1238466653u, 3477467891u,   68755798u,
+    4115633027u, 1041448998u, 3095868040u, 1943789869u, 1860096405u, 2776760880u,  588673182u, 3897205563u,
+     449450869u, 3516317904u, 1459794558u, 2623431131u, 2170245475u, 1242006214u, 3432247400u,  131015629u,
+    4137259288u, 1036337853u, 3142660115u, 1879958454u, 1829294862u, 2790523051u,  549483013u, 3952910752u,
+     300424884u, 3669282065u, 1545650111u, 2541513754u, 2323209378u, 1092980487u, 3350330793u,  216870412u,
+    4256931033u,  921128828u, 2960342482u, 2066738807u, 1714085583u, 2910195050u,  736264132u, 3770592353u,
+     306060335u, 3647131530u, 1610005796u, 2494197377u, 2309971513u, 1123257756u, 3295149874u,  255536279u,
+    4268596802u,  892423655u, 3013951305u, 2029645036u, 1711070292u, 2929725425u,  674528607u, 3815288570u,
+     373562242u, 3709388839u, 1535949449u, 2429577516u, 2379569556u, 1183418929u, 3223189663u,  188820282u,
+    4195850735u,  827017802u, 3084859620u, 2089020225u, 1636228089u, 2866415708u,  743340786u, 3876759895u,
+     361896217u, 3738094268u, 1482340370u, 2466671543u, 2382584591u, 1163888810u, 3284924932u,  144124321u,
+    4190215028u,  849168593u, 3020503679u, 2136336858u, 1649465698u, 2836138695u,  798521449u, 3838094284u
+  },
+  {
+             0u, 2792819636u, 2543784233u,  837294749u, 4098827283u, 1379413927u, 1674589498u, 3316072078u,
+     871321191u, 2509784531u, 2758827854u,   34034938u, 3349178996u, 1641505216u, 1346337629u, 4131942633u,
+    1742642382u, 3249117050u, 4030828007u, 1446413907u, 2475800797u,  904311657u,   68069876u, 2725880384u,
+    1412551337u, 4064729373u, 3283010432u, 1708771380u, 2692675258u,  101317902u,  937551763u, 2442587175u,
+    3485284764u, 1774858792u, 1478633653u, 4266992385u, 1005723023u, 2642744891u, 2892827814u,  169477906u,
+    4233263099u, 1512406095u, 1808623314u, 3451546982u,  136139752u, 2926205020u, 2676114113u,  972376437u,
+    2825102674u,  236236518u, 1073525883u, 2576072655u, 1546420545u, 4200303349u, 3417542760u, 1841601500u,
+    2609703733u, 1039917185u,  202635804u, 2858742184u, 1875103526u, 3384067218u, 4166835727u, 1579931067u,
+    1141601657u, 3799809741u, 3549717584u, 1977839588u, 2957267306u,  372464350u,  668680259u, 2175552503u,
+    2011446046u, 3516084394u, 3766168119u, 1175200131u, 2209029901u,  635180217u,  338955812u, 2990736784u,
+     601221559u, 2242044419u, 3024812190u,  306049834u, 3617246628u, 1911408144u, 1074125965u, 3866285881u,
+     272279504u, 3058543716u, 2275784441u,  567459149u, 3832906691u, 1107462263u, 1944752874u, 3583875422u,
+    2343980261u,  767641425u,  472473036u, 3126744696u, 2147051766u, 3649987394u, 3899029983u, 1309766251u,
+    3092841090u,  506333494u,  801510315u, 2310084639u, 1276520081u, 3932237093u, 3683203000u, 2113813516u,
+    3966292011u, 1243601823u, 2079834370u, 3716205238u,  405271608u, 3192979340u, 2411259153u,  701492901u,
+    3750207052u, 2045810168u, 1209569125u, 4000285905u,  734575199u, 2378150379u, 3159862134u,  438345922u,
+    2283203314u,  778166598u,  529136603u, 3120492655u, 2086260449u, 3660498261u, 3955679176u, 1303499900u,
+    3153699989u,  495890209u,  744928700u, 2316418568u, 1337360518u, 3921775410u, 3626602927u, 2120129051u,
+    4022892092u, 1237286280u, 2018993941u, 3726666913u,  461853231u, 3186645403u, 2350400262u,  711936178u,
+    3693557851u, 2052076527u, 1270360434u, 3989775046u,  677911624u, 2384402428u, 3220639073u,  427820757u,
+    1202443118u, 3789347034u, 3493118535u, 1984154099u, 3018127229u,  362020041u,  612099668u, 2181885408u,
+    1950653705u, 3526596285u, 3822816288u, 1168934804u, 2148251930u,  645706414u,  395618355u, 2984485767u,
+     544559008u, 2248295444u, 3085590153u,  295523645u, 3560598451u, 1917673479u, 1134918298u, 3855773998u,
+     328860103u, 3052210803u, 2214924526u,  577903450u, 3889505748u, 1101147744u, 1883911421u, 3594338121u,
+    3424493451u, 1785369663u, 1535282850u, 4260726038u,  944946072u, 2653270060u, 2949491377u,  163225861u,
+    4294103532u, 1501944408u, 1752023237u, 3457862513u,  196998655u, 2915761739u, 2619532502u,  978710370u,
+    2881684293u,  229902577u, 1012666988u, 2586515928u, 1603020630u, 4193987810u, 3356702335u, 1852063179u,
+    2553040162u, 1046169238u,  263412747u, 2848217023u, 1818454321u, 3390333573u, 4227627032u, 1569420204u,
+      60859927u, 2782375331u, 2487203646u,  843627658u, 4159668740u, 1368951216u, 1617990445u, 3322386585u,
+     810543216u, 2520310724u, 2815490393u,   27783917u, 3288386659u, 1652017111u, 1402985802u, 4125677310u,
+    1685994201u, 3255382381u, 4091620336u, 1435902020u, 2419138250u,  910562686u,  128847843u, 2715354199u,
+    1469150398u, 4058414858u, 3222168983u, 1719234083u, 2749255853u,   94984985u,  876691844u, 2453031472u
+  },
+  {
+             0u, 3433693342u, 1109723005u, 2391738339u, 2219446010u, 1222643300u, 3329165703u,  180685081u,
+    3555007413u,  525277995u, 2445286600u, 1567235158u, 1471092047u, 2600801745u,  361370162u, 3642757804u,
+    2092642603u, 2953916853u, 1050555990u, 4063508168u, 4176560081u,  878395215u, 3134470316u, 1987983410u,
+    2942184094u, 1676945920u, 3984272867u,  567356797u,  722740324u, 3887998202u, 1764827929u, 2778407815u,
+    4185285206u,  903635656u, 3142804779u, 2012833205u, 2101111980u, 2979425330u, 1058630609u, 4088621903u,
+     714308067u, 3862526333u, 1756790430u, 2753330688u, 2933487385u, 1651734407u, 3975966820u,  542535930u,
+    2244825981u, 1231508451u, 3353891840u,  188896414u,   25648519u, 3442302233u, 1134713594u, 2399689316u,
+    1445480648u, 2592229462u,  336416693u, 3634843435u, 3529655858u,  516441772u, 2420588879u, 1559052753u,
+     698204909u, 3845636723u, 1807271312u, 2803025166u, 2916600855u, 1635634313u, 4025666410u,  593021940u,
+    4202223960u,  919787974u, 3093159461u, 1962401467u, 2117261218u, 2996361020u, 1008193759u, 4038971457u,
+    1428616134u, 2576151384u,  386135227u, 3685348389u, 3513580860u,  499580322u, 2471098945u, 1608776415u,
+    2260985971u, 1248454893u, 3303468814u,  139259792u,   42591881u, 3458459159u, 1085071860u, 2349261162u,
+    3505103035u,  474062885u, 2463016902u, 1583654744u, 1419882049u, 2550902495u,  377792828u, 3660491170u,
+      51297038u, 3483679632u, 1093385331u, 2374089965u, 2269427188u, 1273935210u, 3311514249u,  164344343u,
+    2890961296u, 1627033870u, 4000683757u,  585078387u,  672833386u, 3836780532u, 1782552599u, 2794821769u,
+    2142603813u, 3005188795u, 1032883544u, 4047146438u, 4227826911u,  928351297u, 3118105506u, 1970307900u,
+    1396409818u, 2677114180u,  287212199u, 3719594553u, 3614542624u,  467372990u, 2505346141u, 1509854403u,
+    2162073199u, 1282711281u, 3271268626u,  240228748u,   76845205u, 3359543307u, 1186043880u, 2317064054u,
+     796964081u, 3811226735u, 1839575948u, 2702160658u, 2882189835u, 1734392469u, 3924802934u,  625327592u,
+    4234522436u,  818917338u, 3191908409u, 1927981223u, 2016387518u, 3028656416u,  973776579u, 4137723485u,
+    2857232268u, 1726474002u, 3899187441u,  616751215u,  772270454u, 3803048424u, 1814228491u, 2693328533u,
+    2041117753u, 3036871847u,  999160644u, 4146592730u, 4259508931u,  826864221u, 3217552830u, 1936586016u,
+    3606501031u,  442291769u, 2496909786u, 1484378436u, 1388107869u, 2652297411u,  278519584u, 3694387134u,
+      85183762u, 3384397196u, 1194773103u, 2342308593u, 2170143720u, 1307820918u, 3279733909u,  265733131u,
+    2057717559u, 3054258089u,  948125770u, 4096344276u, 4276898253u,  843467091u, 3167309488u, 1885556270u,
+    2839764098u, 1709792284u, 3949353983u,  667704161u,  755585656u, 3785577190u, 1865176325u, 2743489947u,
+     102594076u, 3401021058u, 1144549729u, 2291298815u, 2186770662u, 1325234296u, 3228729243u,  215514885u,
+    3589828009u,  424832311u, 2547870420u, 1534552650u, 1370645331u, 2635621325u,  328688686u, 3745342640u,
+    2211456353u, 1333405183u, 3254067740u,  224338562u,  127544219u, 3408931589u, 1170156774u, 2299866232u,
+    1345666772u, 2627681866u,  303053225u, 3736746295u, 3565105198u,  416624816u, 2522494803u, 1525692365u,
+    4285207626u,  868291796u, 3176010551u, 1910772649u, 2065767088u, 3079346734u,  956571085u, 4121828691u,
+     747507711u, 3760459617u, 1856702594u, 2717976604u, 2831417605u, 1684930971u, 3940615800u,  642451174u
+  }
 };
 
+/*Slicing-by-8 CRC update of the pre-inverted register r. Bytes are combined
+explicitly so the result does not depend on host endianness.*/
+static unsigned crc32_slice8(unsigned r, const unsigned char* data, size_t length)
+{
+  while(length >= 8)
+  {
+    r ^= (unsigned)data[0] | ((unsigned)data[1] << 8) | ((unsigned)data[2] << 16) | ((unsigned)data[3] << 24);
+    r = lodepng_crc32_table[7][r & 0xff] ^ lodepng_crc32_table[6][(r >> 8) & 0xff]
+      ^ lodepng_crc32_table[5][(r >> 16) & 0xff] ^ lodepng_crc32_table[4][r >> 24]
+      ^ lodepng_crc32_table[3][data[4]] ^ lodepng_crc32_table[2][data[5]]
+      ^ lodepng_crc32_table[1][data[6]] ^ lodepng_crc32_table[0][data[7]];
+    data += 8;
+    length -= 8;
+  }
+  while(length--)
+  {
+    r = lodepng_crc32_table[0][(r ^ *data++) & 0xff] ^ (r >> 8);
+  }
+  return r;
+}
+
+#ifdef LODEPNG_COMPILE_X86_SIMD
+/*
+CRC update of the pre-inverted register r with carry-less multiplication, following
+"Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction" (Gopal
+et al., Intel 2009): four 128-bit lanes are folded 64 bytes at a time, reduced to
+one lane, then Barrett-reduced to 32 bits. length must be at least 64 and a
+multiple of 16.
+*/
+__attribute__((target("pclmul,sse4.1")))
+static unsigned crc32_pclmul(unsigned r, const unsigned char* data, size_t length)
+{
+  const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596ll, 0x0154442bd4ll);
+  const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009ell, 0x01751997d0ll);
+  const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124ll);
+  const __m128i poly = _mm_set_epi64x(0x01f7011641ll, 0x01db710641ll);
+  const __m128i mask32 = _mm_setr_epi32(-1, 0, -1, 0);
+  __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+  x1 = _mm_loadu_si128((const __m128i*)(data + 0));
+  x2 = _mm_loadu_si128((const __m128i*)(data + 16));
+  x3 = _mm_loadu_si128((const __m128i*)(data + 32));
+  x4 = _mm_loadu_si128((const __m128i*)(data + 48));
+  x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)r));
+  data += 64;
+  length -= 64;
+
+  /*fold four lanes in parallel*/
+  while(length >= 64)
+  {
+    x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+    x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+    x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+    x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+    x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+    x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+    x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i*)(data + 0)));
+    x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i*)(data + 16)));
+    x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i*)(data + 32)));
+    x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i*)(data + 48)));
+    data += 64;
+    length -= 64;
+  }
+
+  /*fold the four lanes into one*/
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+  x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+  x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+  x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+  /*fold the remaining 16-byte blocks*/
+  while(length >= 16)
+  {
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i*)data)), x5);
+    data += 16;
+    length -= 16;
+  }
+
+  /*128 bits to 64 bits*/
+  x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+  x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+  x2 = _mm_srli_si128(x1, 4);
+  x1 = _mm_and_si128(x1, mask32);
+  x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+
+  /*Barrett reduction to 32 bits*/
+  x2 = _mm_and_si128(x1, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+  x2 = _mm_and_si128(x2, mask32);
+  x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+  x1 = _mm_xor_si128(x1, x2);
+  return (unsigned)_mm_extract_epi32(x1, 1);
+}
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+
 /*Return the CRC of the bytes buf[0..len-1].*/
 unsigned lodepng_crc32(const unsigned char* data, size_t length)
 {
   unsigned r = 0xffffffffu;
-  size_t i;
-  for(i = 0; i < length; ++i)
+#ifdef LODEPNG_COMPILE_X86_SIMD
+  if(length >= 64 && (lodepng_cpu_features() & (LODEPNG_CPU_PCLMUL | LODEPNG_CPU_SSE41))
+                     == (LODEPNG_CPU_PCLMUL | LODEPNG_CPU_SSE41))
   {
-    r = lodepng_crc32_table[(r ^ data[i]) & 0xff] ^ (r >> 8);
+    size_t blocks = length & ~(size_t)15;
+    r = crc32_pclmul(r, data, blocks);
+    data += blocks;
+    length -= blocks;
   }
-  return r ^ 0xffffffffu;
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+  return crc32_slice8(r, data, length) ^ 0xffffffffu;
 }
 #else /* !LODEPNG_NO_COMPILE_CRC */
 unsigned lodepng_crc32(const unsigned char* data, size_t length);
@@ -2568,6 +3627,7 @@ static unsigned getNumColorChannels(LodePNGColorType colortype)
     case 3: return 1; /*palette*/
     case 4: return 2; /*grey + alpha*/
     case 6: return 4; /*RGBA*/
+    case LCT_N64_RGBA: case LCT_N64_IA: case LCT_N64_I: return 1; /*N64 texel, bitdepth is its size*/
   }
   return 0; /*unexisting color type*/
 }
@@ -3415,18 +4475,166 @@ static void getPixelColorsRGBA8(unsigned char* buffer, size_t numpixels,
   }
 }
 
-/*Get RGBA16 color of pixel with index i (y * width + x) from the raw image with
-given color type, but the given color type must be 16-bit itself.*/
-static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned short* b, unsigned short* a,
-                                const unsigned char* in, size_t i, const LodePNGColorMode* mode)
+static int isN64ColorType(LodePNGColorType colortype)
 {
-  if(mode->colortype == LCT_GREY)
+  return colortype == LCT_N64_RGBA || colortype == LCT_N64_IA || colortype == LCT_N64_I;
+}
+
+/*RGBA 5551 texel from RGBA8, the alpha bit is set for any non-zero alpha*/
+static unsigned rgba8ToRGBA5551(const unsigned char* p)
+{
+  return ((unsigned)(p[0] >> 3) << 11) | ((unsigned)(p[1] >> 3) << 6) | ((unsigned)(p[2] >> 3) << 1) | (p[3] > 0);
+}
+
+#ifdef LODEPNG_COMPILE_X86_SIMD
+/*RGBA 5551 texels from 4 RGBA8 pixels (r in the low byte), in the low half of each 32-bit lane*/
+__attribute__((target("sse2")))
+static __m128i rgba8ToRGBA5551x4(__m128i px)
+{
+  __m128i r = _mm_slli_epi32(_mm_and_si128(px, _mm_set1_epi32(0xf8)), 8);
+  __m128i g = _mm_srli_epi32(_mm_and_si128(px, _mm_set1_epi32(0xf800)), 5);
+  __m128i b = _mm_srli_epi32(_mm_and_si128(px, _mm_set1_epi32(0xf80000)), 18);
+  __m128i transparent = _mm_cmpeq_epi32(_mm_srli_epi32(px, 24), _mm_setzero_si128());
+  __m128i a = _mm_andnot_si128(transparent, _mm_set1_epi32(1));
+  return _mm_or_si128(_mm_or_si128(r, g), _mm_or_si128(b, a));
+}
+
+/*big endian RGBA 5551 texels from RGBA8 pixels, 8 at a time, returns how many were done*/
+__attribute__((target("sse2")))
+static size_t rgba8ToRGBA5551SSE2(unsigned char* out, const unsigned char* rgba, size_t numpixels)
+{
+  size_t i = 0;
+  for(; i + 8 <= numpixels; i += 8)
+  {
+    __m128i lo = rgba8ToRGBA5551x4(_mm_loadu_si128((const __m128i*)&rgba[i * 4]));
+    __m128i hi = rgba8ToRGBA5551x4(_mm_loadu_si128((const __m128i*)&rgba[i * 4 + 16]));
+    __m128i texels;
+    /*SSE2 only has a signed 32 to 16 bit pack, sign extend so values above 0x7fff don't saturate*/
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    texels = _mm_packs_epi32(lo, hi);
+    texels = _mm_or_si128(_mm_slli_epi16(texels, 8), _mm_srli_epi16(texels, 8)); /*big endian*/
+    _mm_storeu_si128((__m128i*)&out[i * 2], texels);
+  }
+  return i;
+}
+
+#ifdef LODEPNG_COMPILE_X86_AVX2
+/*AVX2 version of rgba8ToRGBA5551SSE2, 16 at a time*/
+__attribute__((target("avx2")))
+static size_t rgba8ToRGBA5551AVX2(unsigned char* out, const unsigned char* rgba, size_t numpixels)
+{
+  const __m256i maskR = _mm256_set1_epi32(0xf8);
+  const __m256i maskG = _mm256_set1_epi32(0xf800);
+  const __m256i maskB = _mm256_set1_epi32(0xf80000);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one = _mm256_set1_epi32(1);
+  size_t i = 0;
+  for(; i + 16 <= numpixels; i += 16)
   {
-    *r = *g = *b = 256 * in[i * 2 + 0] + in[i * 2 + 1];
-    if(mode->key_defined && 256U * in[i * 2 + 0] + in[i * 2 + 1] == mode->key_r) *a = 0;
-    else *a = 65535;
+    __m256i px[2], texels;
+    int k;
+    px[0] = _mm256_loadu_si256((const __m256i*)&rgba[i * 4]);
+    px[1] = _mm256_loadu_si256((const __m256i*)&rgba[i * 4 + 32]);
+    for(k = 0; k != 2; ++k)
+    {
+      __m256i r = _mm256_slli_epi32(_mm256_and_si256(px[k], maskR), 8);
+      __m256i g = _mm256_srli_epi32(_mm256_and_si256(px[k], maskG), 5);
+      __m256i b = _mm256_srli_epi32(_mm256_and_si256(px[k], maskB), 18);
+      __m256i a = _mm256_andnot_si256(_mm256_cmpeq_epi32(_mm256_srli_epi32(px[k], 24), zero), one);
+      px[k] = _mm256_or_si256(_mm256_or_si256(r, g), _mm256_or_si256(b, a));
+    }
+    /*packus works per 128-bit lane, put the quadwords back in order*/
+    texels = _mm256_permute4x64_epi64(_mm256_packus_epi32(px[0], px[1]), 0xd8);
+    texels = _mm256_or_si256(_mm256_slli_epi16(texels, 8), _mm256_srli_epi16(texels, 8)); /*big endian*/
+    _mm256_storeu_si256((__m256i*)&out[i * 2], texels);
   }
-  else if(mode->colortype == LCT_RGB)
+  return i;
+}
+#endif /*LODEPNG_COMPILE_X86_AVX2*/
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+
+/*
+Convert numpixels pixels to one of the LCT_N64_ texture formats. The input goes
+through a small RGBA8 buffer with getPixelColorsRGBA8, so no full RGBA8 copy of
+the image is made. Returns error 37 for a bitdepth the format doesn't have.
+*/
+static unsigned convertToN64(unsigned char* out, const unsigned char* in, size_t numpixels,
+                             const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in)
+{
+  unsigned char rgba[64 * 4];
+  LodePNGColorType colortype = mode_out->colortype;
+  unsigned bits = mode_out->bitdepth;
+  size_t inbpp = lodepng_get_bpp(mode_in);
+  size_t i, j;
+#ifdef LODEPNG_COMPILE_X86_SIMD
+  unsigned features = lodepng_cpu_features();
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+
+  if(colortype == LCT_N64_RGBA && bits != 16 && bits != 32) return 37;
+  if(colortype == LCT_N64_IA && bits != 8 && bits != 16) return 37;
+  if(colortype == LCT_N64_I && bits != 4 && bits != 8) return 37;
+
+  /*chunks of 64 pixels, so that sub-byte input chunks start at a byte*/
+  for(i = 0; i < numpixels; i += 64)
+  {
+    size_t n = numpixels - i < 64 ? numpixels - i : 64;
+    getPixelColorsRGBA8(rgba, n, 1, &in[i * inbpp / 8], mode_in);
+    j = 0;
+    if(colortype == LCT_N64_RGBA && bits == 16)
+    {
+#ifdef LODEPNG_COMPILE_X86_SIMD
+#ifdef LODEPNG_COMPILE_X86_AVX2
+      if(features & LODEPNG_CPU_AVX2) j = rgba8ToRGBA5551AVX2(&out[i * 2], rgba, n);
+      else
+#endif /*LODEPNG_COMPILE_X86_AVX2*/
+      if(features & LODEPNG_CPU_SSE2) j = rgba8ToRGBA5551SSE2(&out[i * 2], rgba, n);
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+      for(; j != n; ++j)
+      {
+        unsigned texel = rgba8ToRGBA5551(&rgba[j * 4]);
+        out[(i + j) * 2 + 0] = (unsigned char)(texel >> 8);
+        out[(i + j) * 2 + 1] = (unsigned char)texel;
+      }
+    }
+    else if(colortype == LCT_N64_RGBA)
+    {
+      for(; j != n * 4; ++j) out[i * 4 + j] = rgba[j];
+    }
+    else
+    {
+      for(; j != n; ++j)
+      {
+        const unsigned char* p = &rgba[j * 4];
+        size_t k = i + j;
+        unsigned char intensity = (unsigned char)(((unsigned)p[0] + p[1] + p[2]) / 3);
+        if(colortype == LCT_N64_IA && bits == 16)
+        {
+          out[k * 2 + 0] = intensity;
+          out[k * 2 + 1] = p[3];
+        }
+        else if(colortype == LCT_N64_IA) out[k] = (intensity & 0xf0) | (p[3] >> 4);
+        else if(bits == 8) out[k] = intensity;
+        else if(k & 1) out[k / 2] |= intensity >> 4;
+        else out[k / 2] = intensity & 0xf0;
+      }
+    }
+  }
+  return 0;
+}
+
+/*Get RGBA16 color of pixel with index i (y * width + x) from the raw image with
+given color type, but the given color type must be 16-bit itself.*/
+static void getPixelColorRGBA16(unsigned short* r, unsigned short* g, unsigned short* b, unsigned short* a,
+                                const unsigned char* in, size_t i, const LodePNGColorMode* mode)
+{
+  if(mode->colortype == LCT_GREY)
+  {
+    *r = *g = *b = 256 * in[i * 2 + 0] + in[i * 2 + 1];
+    if(mode->key_defined && 256U * in[i * 2 + 0] + in[i * 2 + 1] == mode->key_r) *a = 0;
+    else *a = 65535;
+  }
+  else if(mode->colortype == LCT_RGB)
   {
     *r = 256u * in[i * 6 + 0] + in[i * 6 + 1];
     *g = 256u * in[i * 6 + 2] + in[i * 6 + 3];
@@ -3498,7 +4706,11 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
     }
   }
 
-  if(mode_in->bitdepth == 16 && mode_out->bitdepth == 16)
+  if(isN64ColorType(mode_out->colortype))
+  {
+    error = convertToN64(out, in, numpixels, mode_out, mode_in);
+  }
+  else if(mode_in->bitdepth == 16 && mode_out->bitdepth == 16)
   {
     for(i = 0; i != numpixels; ++i)
     {
@@ -3972,6 +5184,129 @@ unsigned lodepng_inspect(unsigned* w, unsigned* h, LodePNGState* state,
   return state->error;
 }
 
+#ifdef LODEPNG_COMPILE_X86_SIMD
+/*
+Unfiltering of 3- and 4-byte pixels (RGB and RGBA at 8 bits) with SSE2, and SSSE3
+for Paeth. Sub, Average and Paeth depend on the pixel to the left, so they handle
+one pixel per step in the low lanes of a register. Up has no such dependency and
+is done 16 bytes at a time. Pixels are moved byte by byte into the register so
+that 3-byte rows are never read or written past their end, and recon may still be
+at or before scanline as unfilter requires.
+*/
+__attribute__((target("sse2")))
+static __m128i loadPixel(const unsigned char* p, size_t bytewidth)
+{
+  unsigned v = p[0] | ((unsigned)p[1] << 8) | ((unsigned)p[2] << 16);
+  if(bytewidth == 4) v |= (unsigned)p[3] << 24;
+  return _mm_cvtsi32_si128((int)v);
+}
+
+__attribute__((target("sse2")))
+static void storePixel(unsigned char* p, __m128i pixel, size_t bytewidth)
+{
+  unsigned v = (unsigned)_mm_cvtsi128_si32(pixel);
+  p[0] = (unsigned char)v;
+  p[1] = (unsigned char)(v >> 8);
+  p[2] = (unsigned char)(v >> 16);
+  if(bytewidth == 4) p[3] = (unsigned char)(v >> 24);
+}
+
+__attribute__((target("sse2")))
+static void unfilterSubSSE2(unsigned char* recon, const unsigned char* scanline, size_t bytewidth, size_t length)
+{
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i != length; i += bytewidth)
+  {
+    a = _mm_add_epi8(a, loadPixel(&scanline[i], bytewidth));
+    storePixel(&recon[i], a, bytewidth);
+  }
+}
+
+__attribute__((target("sse2")))
+static void unfilterUpSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                           size_t length)
+{
+  size_t i = 0;
+  for(; i + 16 <= length; i += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)&scanline[i]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&precon[i]);
+    _mm_storeu_si128((__m128i*)&recon[i], _mm_add_epi8(x, b));
+  }
+  for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+}
+
+__attribute__((target("sse2")))
+static void unfilterAvgSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                            size_t bytewidth, size_t length)
+{
+  const __m128i one = _mm_set1_epi8(1);
+  __m128i a = _mm_setzero_si128();
+  size_t i;
+  for(i = 0; i != length; i += bytewidth)
+  {
+    __m128i b = loadPixel(&precon[i], bytewidth);
+    /*_mm_avg_epu8 rounds up, (a + b) >> 1 rounds down*/
+    __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+    a = _mm_add_epi8(avg, loadPixel(&scanline[i], bytewidth));
+    storePixel(&recon[i], a, bytewidth);
+  }
+}
+
+/*same choice as paethPredictor, on one pixel widened to 16-bit lanes*/
+__attribute__((target("ssse3")))
+static void unfilterPaethSSSE3(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                               size_t bytewidth, size_t length)
+{
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  size_t i;
+  for(i = 0; i != length; i += bytewidth)
+  {
+    __m128i b = _mm_unpacklo_epi8(loadPixel(&precon[i], bytewidth), zero);
+    __m128i pa = _mm_sub_epi16(b, c); /*p - a, where p = a + b - c*/
+    __m128i pb = _mm_sub_epi16(a, c); /*p - b*/
+    __m128i pc = _mm_add_epi16(pa, pb); /*p - c*/
+    __m128i smallest, predictor, x;
+    pa = _mm_abs_epi16(pa);
+    pb = _mm_abs_epi16(pb);
+    pc = _mm_abs_epi16(pc);
+    smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+    /*a if pa is smallest, else b if pb is, else c*/
+    predictor = _mm_cmpeq_epi16(smallest, pb);
+    predictor = _mm_or_si128(_mm_and_si128(predictor, b), _mm_andnot_si128(predictor, c));
+    x = _mm_cmpeq_epi16(smallest, pa);
+    predictor = _mm_or_si128(_mm_and_si128(x, a), _mm_andnot_si128(x, predictor));
+    x = _mm_unpacklo_epi8(loadPixel(&scanline[i], bytewidth), zero);
+    a = _mm_add_epi8(x, predictor); /*wraps per byte, so the high bytes stay zero*/
+    storePixel(&recon[i], _mm_packus_epi16(a, a), bytewidth);
+    c = b;
+  }
+}
+
+/*returns 1 if the scanline was unfiltered here, 0 if the scalar code must do it*/
+static int unfilterScanlineSIMD(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, unsigned char filterType, size_t length)
+{
+  unsigned features;
+  if(bytewidth != 3 && bytewidth != 4) return 0;
+  if(filterType < 1 || filterType > 4 || (filterType != 1 && !precon)) return 0;
+  features = lodepng_cpu_features();
+  if(filterType == 4)
+  {
+    if(!(features & LODEPNG_CPU_SSSE3)) return 0;
+    unfilterPaethSSSE3(recon, scanline, precon, bytewidth, length);
+    return 1;
+  }
+  if(!(features & LODEPNG_CPU_SSE2)) return 0;
+  if(filterType == 1) unfilterSubSSE2(recon, scanline, bytewidth, length);
+  else if(filterType == 2) unfilterUpSSE2(recon, scanline, precon, length);
+  else unfilterAvgSSE2(recon, scanline, precon, bytewidth, length);
+  return 1;
+}
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+
 static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
                                  size_t bytewidth, unsigned char filterType, size_t length)
 {
@@ -3985,6 +5320,10 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   */
 
   size_t i;
+#ifdef LODEPNG_COMPILE_X86_SIMD
+  if(unfilterScanlineSIMD(recon, scanline, precon, bytewidth, filterType, length)) return 0;
+#endif /*LODEPNG_COMPILE_X86_SIMD*/
+
   switch(filterType)
   {
     case 0:
@@ -4385,9 +5724,9 @@ static unsigned readChunk_zTXt(LodePNGInfo* info, const LodePNGDecompressSetting
 
     length = (unsigned)chunkLength - string2_begin;
     /*will fail if zlib error, e.g. if length is too small*/
-    error = zlib_decompress(&decoded.data, &decoded.size,
+    error = zlib_decompress(&decoded.data, &decoded.size, 0,
                             (unsigned char*)(&data[string2_begin]),
-                            length, zlibsettings);
+                            length, zlibsettings, 0);
     if(error) break;
     ucvector_push_back(&decoded, 0);
 
@@ -4468,9 +5807,9 @@ static unsigned readChunk_iTXt(LodePNGInfo* info, const LodePNGDecompressSetting
     if(compressed)
     {
       /*will fail if zlib error, e.g. if length is too small*/
-      error = zlib_decompress(&decoded.data, &decoded.size,
+      error = zlib_decompress(&decoded.data, &decoded.size, 0,
                               (unsigned char*)(&data[begin]),
-                              length, zlibsettings);
+                              length, zlibsettings, 0);
       if(error) break;
       if(decoded.allocsize < decoded.size) decoded.allocsize = decoded.size;
       ucvector_push_back(&decoded, 0);
@@ -4525,18 +5864,64 @@ static unsigned readChunk_pHYs(LodePNGInfo* info, const unsigned char* data, siz
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
 /*read a PNG, the result will be in the same color type as the PNG (hence "generic")*/
-static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
-                          LodePNGState* state,
-                          const unsigned char* in, size_t insize)
+/*
+Unfilters the non-interlaced scanlines in and converts every row to mode_out right
+away, while it is still in cache, so only two unfiltered rows are kept instead of
+a whole image in the PNG's color type. Each output row must start at a byte, so
+w times the bits per pixel of mode_out must be a multiple of 8.
+*/
+static unsigned unfilterAndConvert(unsigned char* out, const unsigned char* in, unsigned w, unsigned h,
+                                   const LodePNGColorMode* mode_out, const LodePNGColorMode* mode_in)
+{
+  unsigned bpp = lodepng_get_bpp(mode_in);
+  size_t bytewidth = (bpp + 7) / 8;
+  size_t linebytes = ((size_t)w * bpp + 7) / 8;
+  size_t outlinebytes = lodepng_get_raw_size(w, 1, mode_out);
+  unsigned char* lines;
+  unsigned char* prevline = 0;
+  unsigned y;
+  unsigned error = 0;
+
+  if(bpp == 0) return 31; /*error: invalid colortype*/
+  lines = (unsigned char*)lodepng_malloc(linebytes * 2);
+  if(!lines) return 83; /*alloc fail*/
+
+  for(y = 0; y < h && !error; ++y)
+  {
+    unsigned char* line = &lines[(y & 1) * linebytes];
+    const unsigned char* scanline = &in[(1 + linebytes) * y]; /*starts with the filter type byte*/
+    error = unfilterScanline(line, &scanline[1], prevline, bytewidth, scanline[0], linebytes);
+    if(!error) error = lodepng_convert(&out[outlinebytes * y], line, mode_out, mode_in, w, 1);
+    prevline = line;
+  }
+
+  lodepng_free(lines);
+  return error;
+}
+
+/*whether decodeGeneric can produce info_raw directly with unfilterAndConvert*/
+static unsigned canConvertScanlines(const LodePNGState* state, unsigned w)
+{
+  const LodePNGColorMode* mode_out = &state->info_raw;
+  if(!state->decoder.color_convert || lodepng_color_mode_equal(mode_out, &state->info_png.color)) return 0;
+  if(state->info_png.interlace_method != 0) return 0;
+  if(mode_out->colortype == LCT_PALETTE || ((size_t)w * lodepng_get_bpp(mode_out)) % 8 != 0) return 0;
+  if(isN64ColorType(mode_out->colortype)) return 1;
+  /*other conversions are refused with error 56 by lodepng_decode*/
+  return mode_out->colortype == LCT_RGB || mode_out->colortype == LCT_RGBA || mode_out->bitdepth == 8;
+}
+
+/*
+Reads the header and the chunks up to IEND into state->info_png, and appends the
+IDAT data to idat. Errors are set in state->error.
+*/
+static void decodeChunks(ucvector* idat, unsigned* w, unsigned* h, LodePNGState* state,
+                         const unsigned char* in, size_t insize)
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
   size_t i;
-  ucvector idat; /*the data from idat chunks*/
-  ucvector scanlines;
-  size_t predict;
   size_t numpixels;
-  size_t outsize = 0;
 
   /*for unknown chunk order*/
   unsigned unknown = 0;
@@ -4544,9 +5929,6 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   unsigned critical_pos = 1; /*1 = after IHDR, 2 = after PLTE, 3 = after IDAT*/
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
 
-  /*provide some proper output values if error will happen*/
-  *out = 0;
-
   state->error = lodepng_inspect(w, h, state, in, insize); /*reads header and resets other parameters in state->info_png*/
   if(state->error) return;
 
@@ -4558,7 +5940,6 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   bytes with 16-bit RGBA, the rest is room for filter bytes.*/
   if(numpixels > 268435455) CERROR_RETURN(state->error, 92);
 
-  ucvector_init(&idat);
   chunk = &in[33]; /*first byte of the first chunk after the header*/
 
   /*loop through the chunks, ignoring unknown chunks and stopping at IEND chunk.
@@ -4594,9 +5975,9 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     /*IDAT chunk, containing compressed image data*/
     if(lodepng_chunk_type_equals(chunk, "IDAT"))
     {
-      size_t oldsize = idat.size;
-      if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
+      size_t oldsize = idat->size;
+      if(!ucvector_resize(idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
+      for(i = 0; i != chunkLength; ++i) idat->data[oldsize + i] = data[i];
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4692,59 +6073,186 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 
     if(!IEND) chunk = lodepng_chunk_next_const(chunk);
   }
+}
 
-  ucvector_init(&scanlines);
-  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
-  If the decompressed size does not match the prediction, the image must be corrupt.*/
-  if(state->info_png.interlace_method == 0)
+/*
+Size of the decompressed IDAT data: the filtered scanlines with their filter
+bytes, of all 7 reduced images if Adam7 interlaced.
+*/
+static size_t predictScanlinesSize(unsigned w, unsigned h, const LodePNGInfo* info_png)
+{
+  const LodePNGColorMode* color = &info_png->color;
+  size_t predict = 0;
+  if(info_png->interlace_method == 0)
   {
-    /*The extra *h is added because this are the filter bytes every scanline starts with*/
-    predict = lodepng_get_raw_size_idat(*w, *h, &state->info_png.color) + *h;
+    /*The extra h is added because this are the filter bytes every scanline starts with*/
+    predict = lodepng_get_raw_size_idat(w, h, color) + h;
   }
   else
   {
     /*Adam-7 interlaced: predicted size is the sum of the 7 sub-images sizes*/
-    const LodePNGColorMode* color = &state->info_png.color;
-    predict = 0;
-    predict += lodepng_get_raw_size_idat((*w + 7) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
-    if(*w > 4) predict += lodepng_get_raw_size_idat((*w + 3) >> 3, (*h + 7) >> 3, color) + ((*h + 7) >> 3);
-    predict += lodepng_get_raw_size_idat((*w + 3) >> 2, (*h + 3) >> 3, color) + ((*h + 3) >> 3);
-    if(*w > 2) predict += lodepng_get_raw_size_idat((*w + 1) >> 2, (*h + 3) >> 2, color) + ((*h + 3) >> 2);
-    predict += lodepng_get_raw_size_idat((*w + 1) >> 1, (*h + 1) >> 2, color) + ((*h + 1) >> 2);
-    if(*w > 1) predict += lodepng_get_raw_size_idat((*w + 0) >> 1, (*h + 1) >> 1, color) + ((*h + 1) >> 1);
-    predict += lodepng_get_raw_size_idat((*w + 0), (*h + 0) >> 1, color) + ((*h + 0) >> 1);
+    predict += lodepng_get_raw_size_idat((w + 7) >> 3, (h + 7) >> 3, color) + ((h + 7) >> 3);
+    if(w > 4) predict += lodepng_get_raw_size_idat((w + 3) >> 3, (h + 7) >> 3, color) + ((h + 7) >> 3);
+    predict += lodepng_get_raw_size_idat((w + 3) >> 2, (h + 3) >> 3, color) + ((h + 3) >> 3);
+    if(w > 2) predict += lodepng_get_raw_size_idat((w + 1) >> 2, (h + 3) >> 2, color) + ((h + 3) >> 2);
+    predict += lodepng_get_raw_size_idat((w + 1) >> 1, (h + 1) >> 2, color) + ((h + 1) >> 2);
+    if(w > 1) predict += lodepng_get_raw_size_idat((w + 0) >> 1, (h + 1) >> 1, color) + ((h + 1) >> 1);
+    predict += lodepng_get_raw_size_idat((w + 0), (h + 0) >> 1, color) + ((h + 0) >> 1);
   }
-  if(!state->error && !ucvector_reserve(&scanlines, predict)) state->error = 83; /*alloc fail*/
-  if(!state->error)
+  return predict;
+}
+
+/*the arena for the temporary buffers of a decode with these settings, 0 for the heap*/
+static LodePNGArena* decoderArena(const LodePNGDecoderSettings* settings)
+{
+  if(settings->arena) return settings->arena;
+  return settings->context ? &settings->context->arena : 0;
+}
+
+/*Marks the start of a decode with the context, if any. Its arena is reset when no
+other decode uses it, as every temporary buffer of the previous ones is freed.*/
+static void beginContextDecode(LodePNGDecoderContext* context)
+{
+  if(context && context->decoding++ == 0) lodepng_arena_reset(&context->arena);
+}
+
+static void endContextDecode(LodePNGDecoderContext* context)
+{
+  if(context) --context->decoding;
+}
+
+/*lends the context's spare IDAT buffer to idat, if there is one, or inits idat empty*/
+static void takeContextIdat(ucvector* idat, LodePNGDecoderContext* context)
+{
+  ucvector_init(idat);
+  if(context && context->idat)
   {
-    state->error = zlib_decompress(&scanlines.data, &scanlines.size, idat.data,
-                                   idat.size, &state->decoder.zlibsettings);
-    if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+    idat->data = context->idat;
+    idat->allocsize = context->idatsize;
+    context->idat = 0;
+    context->idatsize = 0;
   }
-  ucvector_cleanup(&idat);
+}
 
-  if(!state->error)
+/*gives the buffer back to the context if it is bigger than its spare one, frees it otherwise*/
+static void returnContextIdat(ucvector* idat, LodePNGDecoderContext* context)
+{
+  if(context && idat->allocsize > context->idatsize)
   {
-    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+    lodepng_free(context->idat);
+    context->idat = idat->data;
+    context->idatsize = idat->allocsize;
+    ucvector_init(idat);
+  }
+  else ucvector_cleanup(idat);
+}
+
+/*The context's fixed Huffman trees, built here rather than by the inflater so
+they never come from an arena. 0 without a context, the inflater then builds its own.*/
+static InflateFixedTrees* contextFixedTrees(LodePNGDecoderContext* context)
+{
+#ifdef LODEPNG_COMPILE_ZLIB
+  InflateFixedTrees* fixed;
+  if(!context) return 0;
+  fixed = (InflateFixedTrees*)context->fixedtrees;
+  if(!fixed)
+  {
+    fixed = (InflateFixedTrees*)lodepng_malloc(sizeof(InflateFixedTrees));
+    if(!fixed) return 0;
+    InflateFixedTrees_init(fixed);
+    context->fixedtrees = fixed;
+  }
+  return InflateFixedTrees_build(fixed) ? 0 : fixed;
+#else /*LODEPNG_COMPILE_ZLIB*/
+  (void)context;
+  return 0;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+}
+
+/*converted is set to 1 if out is already in the info_raw color type rather than info_png's*/
+static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h, unsigned* converted,
+                          LodePNGState* state,
+                          const unsigned char* in, size_t insize)
+{
+  ucvector idat; /*the data from idat chunks*/
+  ucvector scanlines;
+  size_t predict;
+  size_t outsize = 0;
+  size_t i;
+  LodePNGDecoderContext* context = state->decoder.context;
+  LodePNGArena* arena;
+  LodePNGArena* previousarena;
+  InflateFixedTrees* fixed;
+
+  /*provide some proper output values if error will happen*/
+  *out = 0;
+  *converted = 0;
+
+  beginContextDecode(context);
+  takeContextIdat(&idat, context);
+  decodeChunks(&idat, w, h, state, in, insize);
+  if(state->error)
+  {
+    returnContextIdat(&idat, context);
+    endContextDecode(context);
+    return;
+  }
+  fixed = contextFixedTrees(context);
+  arena = decoderArena(&state->decoder);
+
+  /*from here on everything allocated is temporary, except out*/
+  previousarena = lodepng_arena_enter(arena);
+  ucvector_init(&scanlines);
+  /*predict output size, to allocate exact size for output buffer to avoid more dynamic allocation.
+  If the decompressed size does not match the prediction, the image must be corrupt.*/
+  predict = predictScanlinesSize(*w, *h, &state->info_png);
+  /*the inflater allocates the predicted size at once*/
+  state->error = zlib_decompress(&scanlines.data, &scanlines.size, predict, idat.data,
+                                 idat.size, &state->decoder.zlibsettings, fixed);
+  if(!state->error && scanlines.size != predict) state->error = 91; /*decompressed size doesn't match prediction*/
+  returnContextIdat(&idat, context);
+
+  if(!state->error && canConvertScanlines(state, *w))
+  {
+    outsize = lodepng_get_raw_size(*w, *h, &state->info_raw);
+    lodepng_arena_enter(0);
     *out = (unsigned char*)lodepng_malloc(outsize);
+    lodepng_arena_enter(arena);
     if(!*out) state->error = 83; /*alloc fail*/
+    else state->error = unfilterAndConvert(*out, scanlines.data, *w, *h, &state->info_raw, &state->info_png.color);
+    *converted = 1;
   }
-  if(!state->error)
+  else if(!state->error)
   {
-    for(i = 0; i < outsize; i++) (*out)[i] = 0;
-    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    outsize = lodepng_get_raw_size(*w, *h, &state->info_png.color);
+    lodepng_arena_enter(0);
+    *out = (unsigned char*)lodepng_malloc(outsize);
+    lodepng_arena_enter(arena);
+    if(!*out) state->error = 83; /*alloc fail*/
+    else
+    {
+      for(i = 0; i < outsize; i++) (*out)[i] = 0;
+      state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    }
   }
   ucvector_cleanup(&scanlines);
+  lodepng_arena_enter(previousarena);
+  endContextDecode(context);
 }
 
 unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
                         LodePNGState* state,
                         const unsigned char* in, size_t insize)
 {
+  unsigned converted;
   *out = 0;
-  decodeGeneric(out, w, h, state, in, insize);
+  decodeGeneric(out, w, h, &converted, state, in, insize);
   if(state->error) return state->error;
-  if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
+  if(converted)
+  {
+    /*unfiltered straight into info_raw, nothing left to do*/
+  }
+  else if(!state->decoder.color_convert || lodepng_color_mode_equal(&state->info_raw, &state->info_png.color))
   {
     /*same color type, no copying or converting of data needed*/
     /*store the info_png color settings on the info_raw so that the info_raw still reflects what colortype
@@ -4764,7 +6272,7 @@ unsigned lodepng_decode(unsigned char** out, unsigned* w, unsigned* h,
     /*TODO: check if this works according to the statement in the documentation: "The converter can convert
     from greyscale input color type, to 8-bit greyscale or greyscale with alpha"*/
     if(!(state->info_raw.colortype == LCT_RGB || state->info_raw.colortype == LCT_RGBA)
-       && !(state->info_raw.bitdepth == 8))
+       && !(state->info_raw.bitdepth == 8) && !isN64ColorType(state->info_raw.colortype))
     {
       return 56; /*unsupported color mode conversion*/
     }
@@ -4805,6 +6313,297 @@ unsigned lodepng_decode24(unsigned char** out, unsigned* w, unsigned* h, const u
   return lodepng_decode_memory(out, w, h, in, insize, LCT_RGB, 8);
 }
 
+#ifdef LODEPNG_COMPILE_ZLIB
+/*
+Inflater that can stop and resume between Huffman symbols, so that a zlib stream
+is decompressed a few scanlines at a time. Bytes the caller has consumed are
+dropped from out, except the last 32768 which matches may still refer back to.
+*/
+typedef struct InflateStream
+{
+  LodePNGBitReader reader;
+  ucvector out;
+  size_t pos; /*end of the decompressed bytes in out*/
+  size_t consumed; /*start of the bytes in out not yet handed to the caller*/
+  HuffmanTree tree_ll, tree_d; /*trees of the current Huffman block, if it has dynamic trees*/
+  InflateFixedTrees ownfixed;
+  InflateFixedTrees* fixed; /*the shared fixed trees, or ownfixed*/
+  unsigned usefixed; /*whether the current Huffman block uses the fixed trees*/
+  unsigned inblock; /*whether a Huffman block is in progress*/
+  unsigned bfinal; /*whether the current or last block is the final one*/
+  unsigned done; /*whether the final block has ended*/
+} InflateStream;
+
+/*fixed: the fixed trees to share, or 0 to build them in the stream itself*/
+static void InflateStream_init(InflateStream* s, const unsigned char* in, size_t insize,
+                               InflateFixedTrees* fixed)
+{
+  LodePNGBitReader_init(&s->reader, in, insize);
+  ucvector_init(&s->out);
+  s->pos = s->consumed = 0;
+  HuffmanTree_init(&s->tree_ll);
+  HuffmanTree_init(&s->tree_d);
+  InflateFixedTrees_init(&s->ownfixed);
+  s->fixed = fixed ? fixed : &s->ownfixed;
+  s->usefixed = s->inblock = s->bfinal = s->done = 0;
+}
+
+static void InflateStream_cleanup(InflateStream* s)
+{
+  ucvector_cleanup(&s->out);
+  HuffmanTree_cleanup(&s->tree_ll);
+  HuffmanTree_cleanup(&s->tree_d);
+  InflateFixedTrees_cleanup(&s->ownfixed);
+}
+
+/*decompress until at least wanted bytes after consumed are available, or the stream ended*/
+static unsigned InflateStream_fill(InflateStream* s, size_t wanted)
+{
+  unsigned error = 0;
+
+  if(s->consumed > 65536)
+  {
+    size_t drop = s->consumed - 32768;
+    memmove(s->out.data, s->out.data + drop, s->pos - drop);
+    s->pos -= drop;
+    s->consumed -= drop;
+    s->out.size = s->pos;
+  }
+
+  while(!error && !s->done && s->pos - s->consumed < wanted)
+  {
+    if(s->inblock)
+    {
+      unsigned end;
+      const HuffmanTree* tree_ll = s->usefixed ? &s->fixed->tree_ll : &s->tree_ll;
+      const HuffmanTree* tree_d = s->usefixed ? &s->fixed->tree_d : &s->tree_d;
+      error = inflateHuffmanSymbols(&s->out, &s->reader, &s->pos, tree_ll, tree_d,
+                                    s->consumed + wanted, &end);
+      if(end)
+      {
+        HuffmanTree_cleanup(&s->tree_ll);
+        HuffmanTree_cleanup(&s->tree_d);
+        HuffmanTree_init(&s->tree_ll);
+        HuffmanTree_init(&s->tree_d);
+        s->inblock = 0;
+        s->done = s->bfinal;
+      }
+    }
+    else
+    {
+      unsigned BTYPE;
+      if(s->reader.bp + 2 >= s->reader.bitsize) return 52; /*error, bit pointer will jump past memory*/
+      ensureBits(&s->reader, 3);
+      s->bfinal = readBits(&s->reader, 1);
+      BTYPE = readBits(&s->reader, 2);
+
+      if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
+      else if(BTYPE == 0)
+      {
+        error = inflateNoCompression(&s->out, &s->reader, &s->pos);
+        s->done = s->bfinal;
+      }
+      else
+      {
+        s->usefixed = BTYPE == 1;
+        if(BTYPE == 1) error = InflateFixedTrees_build(s->fixed);
+        else error = getTreeInflateDynamic(&s->tree_ll, &s->tree_d, &s->reader);
+        s->inblock = 1;
+      }
+    }
+  }
+
+  return error;
+}
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+struct LodePNGRowDecoder
+{
+  LodePNGState* state;
+  unsigned w, h;
+  unsigned y; /*rows handed out so far*/
+  size_t outlinebytes; /*bytes per row in the info_raw color type*/
+  unsigned char* image; /*the whole image, when it isn't decoded row by row*/
+  /*the rest is only used when decoding row by row*/
+  unsigned convert; /*whether rows are converted from info_png's color type to info_raw's*/
+  size_t bytewidth, linebytes; /*of the PNG scanlines, linebytes without the filter type byte*/
+  unsigned char* lines; /*the current and the previous unfiltered scanline*/
+  ucvector idat;
+#ifdef LODEPNG_COMPILE_ZLIB
+  InflateStream inflater;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  unsigned adler; /*Adler-32 of the scanlines decompressed so far*/
+};
+
+unsigned lodepng_row_decoder_init(LodePNGRowDecoder** decoder, unsigned* w, unsigned* h,
+                                  LodePNGState* state, const unsigned char* in, size_t insize)
+{
+  LodePNGRowDecoder* d = (LodePNGRowDecoder*)lodepng_malloc(sizeof(LodePNGRowDecoder));
+  const LodePNGDecompressSettings* zlibsettings = &state->decoder.zlibsettings;
+  unsigned equal, streamable;
+
+  *decoder = d;
+  if(!d) return 83; /*alloc fail*/
+  d->state = state;
+  d->y = 0;
+  d->image = 0;
+  d->lines = 0;
+  d->adler = 1;
+  beginContextDecode(state->decoder.context);
+  takeContextIdat(&d->idat, state->decoder.context);
+#ifdef LODEPNG_COMPILE_ZLIB
+  InflateStream_init(&d->inflater, 0, 0, 0);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+  decodeChunks(&d->idat, w, h, state, in, insize);
+  d->w = *w;
+  d->h = *h;
+  if(!state->error && !state->decoder.color_convert)
+  {
+    state->error = lodepng_color_mode_copy(&state->info_raw, &state->info_png.color);
+  }
+  /*rows are handed out separately, so each must start at a byte*/
+  if(!state->error && ((size_t)d->w * lodepng_get_bpp(&state->info_raw)) % 8 != 0) state->error = 95;
+  if(state->error)
+  {
+    lodepng_row_decoder_finish(d);
+    *decoder = 0;
+    return state->error;
+  }
+
+  d->outlinebytes = lodepng_get_raw_size(d->w, 1, &state->info_raw);
+#ifdef LODEPNG_COMPILE_ZLIB
+  equal = lodepng_color_mode_equal(&state->info_raw, &state->info_png.color);
+  streamable = state->info_png.interlace_method == 0 && !zlibsettings->custom_zlib
+            && !zlibsettings->custom_inflate && (equal || canConvertScanlines(state, d->w));
+#else /*LODEPNG_COMPILE_ZLIB*/
+  streamable = 0; /*there is no inflater to stream with*/
+  (void)zlibsettings;
+  (void)equal;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  if(streamable)
+  {
+#ifdef LODEPNG_COMPILE_ZLIB
+    unsigned bpp = lodepng_get_bpp(&state->info_png.color);
+    LodePNGArena* previousarena;
+    InflateFixedTrees* fixed;
+    d->convert = !equal;
+    d->bytewidth = (bpp + 7) / 8;
+    d->linebytes = ((size_t)d->w * bpp + 7) / 8;
+    fixed = contextFixedTrees(state->decoder.context);
+    previousarena = lodepng_arena_enter(decoderArena(&state->decoder));
+    d->lines = (unsigned char*)lodepng_malloc(d->linebytes * 2);
+    lodepng_arena_enter(previousarena);
+    if(!d->lines) state->error = 83; /*alloc fail*/
+    else state->error = zlib_checkHeader(d->idat.data, d->idat.size);
+    if(!state->error) InflateStream_init(&d->inflater, d->idat.data + 2, d->idat.size - 2, fixed);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  }
+  else
+  {
+    /*interlaced, or a conversion lodepng_decode has to report on: decode it all now*/
+    lodepng_decode(&d->image, w, h, state, in, insize);
+  }
+
+  if(state->error)
+  {
+    lodepng_row_decoder_finish(d);
+    *decoder = 0;
+  }
+  return state->error;
+}
+
+unsigned lodepng_row_decoder_next_rows(LodePNGRowDecoder* decoder, unsigned char* out, unsigned n, unsigned* rows)
+{
+  LodePNGRowDecoder* d = decoder;
+#ifdef LODEPNG_COMPILE_ZLIB
+  LodePNGState* state = d->state;
+  InflateStream* s = &d->inflater;
+  unsigned error = 0;
+  LodePNGArena* previousarena;
+#endif /*LODEPNG_COMPILE_ZLIB*/
+
+  *rows = 0;
+  if(n > d->h - d->y) n = d->h - d->y;
+  if(d->image)
+  {
+    memcpy(out, &d->image[d->y * d->outlinebytes], n * d->outlinebytes);
+    d->y += n;
+    *rows = n;
+    return 0;
+  }
+
+#ifdef LODEPNG_COMPILE_ZLIB
+  /*the inflater's buffer and trees are temporary*/
+  previousarena = lodepng_arena_enter(decoderArena(&state->decoder));
+  while(*rows < n)
+  {
+    unsigned char* line = &d->lines[(d->y & 1) * d->linebytes];
+    unsigned char* prevline = d->y ? &d->lines[((d->y + 1) & 1) * d->linebytes] : 0;
+    unsigned char* outline = &out[*rows * d->outlinebytes];
+    const unsigned char* scanline; /*starts with the filter type byte*/
+
+    error = InflateStream_fill(s, 1 + d->linebytes);
+    if(error) break;
+    if(s->pos - s->consumed < 1 + d->linebytes) ERROR_BREAK(91); /*decompressed size doesn't match prediction*/
+    scanline = &s->out.data[s->consumed];
+    s->consumed += 1 + d->linebytes;
+    if(!state->decoder.zlibsettings.ignore_adler32)
+    {
+      d->adler = update_adler32(d->adler, scanline, (unsigned)(1 + d->linebytes));
+    }
+
+    error = unfilterScanline(line, &scanline[1], prevline, d->bytewidth, scanline[0], d->linebytes);
+    if(error) break;
+    if(d->convert) error = lodepng_convert(outline, line, &state->info_raw, &state->info_png.color, d->w, 1);
+    else memcpy(outline, line, d->linebytes);
+    if(error) break;
+
+    ++d->y;
+    ++(*rows);
+  }
+  lodepng_arena_enter(previousarena);
+
+  state->error = error;
+  return error;
+#else /*LODEPNG_COMPILE_ZLIB*/
+  return 0; /*without the inflater there is always an image*/
+#endif /*LODEPNG_COMPILE_ZLIB*/
+}
+
+unsigned lodepng_row_decoder_finish(LodePNGRowDecoder* decoder)
+{
+  LodePNGRowDecoder* d = decoder;
+  unsigned error = 0;
+  LodePNGArena* previousarena;
+
+  if(!d) return 0;
+  previousarena = lodepng_arena_enter(decoderArena(&d->state->decoder));
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(d->lines && d->y == d->h && !d->state->error)
+  {
+    /*all rows were read, so the zlib stream must end here*/
+    error = InflateStream_fill(&d->inflater, 1);
+    if(!error && d->inflater.pos != d->inflater.consumed) error = 91; /*more data than the image has*/
+    if(!error && !d->state->decoder.zlibsettings.ignore_adler32)
+    {
+      if(d->idat.size < 6) error = 53; /*error, size of zlib data too small*/
+      else if(d->adler != lodepng_read32bitInt(&d->idat.data[d->idat.size - 4])) error = 58;
+    }
+    d->state->error = error;
+  }
+
+  InflateStream_cleanup(&d->inflater);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  lodepng_free(d->lines);
+  lodepng_arena_enter(previousarena);
+  returnContextIdat(&d->idat, d->state->decoder.context);
+  endContextDecode(d->state->decoder.context);
+  lodepng_free(d->image);
+  lodepng_free(d);
+  return error;
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned lodepng_decode_file(unsigned char** out, unsigned* w, unsigned* h, const char* filename,
                              LodePNGColorType colortype, unsigned bitdepth)
@@ -4839,9 +6638,58 @@ void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
   settings->ignore_crc = 0;
   settings->ignore_critical = 0;
   settings->ignore_end = 0;
+  settings->arena = 0;
+  settings->context = 0;
   lodepng_decompress_settings_init(&settings->zlibsettings);
 }
 
+void lodepng_arena_init(LodePNGArena* arena)
+{
+  arena->data = 0;
+  arena->size = arena->used = arena->last = 0;
+  arena->spilled = arena->peak = 0;
+}
+
+void lodepng_arena_reset(LodePNGArena* arena)
+{
+  if(arena->peak > arena->size)
+  {
+    /*one block big enough for everything the last images needed at once*/
+    size_t size = arena->peak + (arena->peak >> 3);
+    lodepng_free(arena->data);
+    arena->data = (unsigned char*)lodepng_malloc(size);
+    arena->size = arena->data ? size : 0;
+  }
+  arena->used = arena->last = 0;
+  arena->spilled = arena->peak = 0;
+}
+
+void lodepng_arena_cleanup(LodePNGArena* arena)
+{
+  lodepng_free(arena->data);
+  lodepng_arena_init(arena);
+}
+
+void lodepng_decoder_context_init(LodePNGDecoderContext* context)
+{
+  lodepng_arena_init(&context->arena);
+  context->decoding = 0;
+  context->idat = 0;
+  context->idatsize = 0;
+  context->fixedtrees = 0;
+}
+
+void lodepng_decoder_context_cleanup(LodePNGDecoderContext* context)
+{
+  lodepng_arena_cleanup(&context->arena);
+  lodepng_free(context->idat);
+#ifdef LODEPNG_COMPILE_ZLIB
+  if(context->fixedtrees) InflateFixedTrees_cleanup((InflateFixedTrees*)context->fixedtrees);
+#endif /*LODEPNG_COMPILE_ZLIB*/
+  lodepng_free(context->fixedtrees);
+  lodepng_decoder_context_init(context);
+}
+
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #if defined(LODEPNG_COMPILE_DECODER) || defined(LODEPNG_COMPILE_ENCODER)
@@ -6017,6 +7865,8 @@ const char* lodepng_error_text(unsigned code)
     case 92: return "too many pixels, not supported";
     case 93: return "zero width or height is invalid";
     case 94: return "header chunk must have a size of 13 bytes";
+    /*rows of the row decoder are handed out separately, so they can't share a byte*/
+    case 95: return "row decoding needs output rows that start at a byte";
   }
   return "unknown error code";
 }
@@ -6033,6 +7883,29 @@ namespace lodepng
 {
 
 #ifdef LODEPNG_COMPILE_DISK
+FileView::FileView()
+{
+  view.data = 0;
+  view.size = 0;
+  view.mapped = 0;
+}
+
+FileView::~FileView()
+{
+  lodepng_file_view_cleanup(&view);
+}
+
+unsigned FileView::load(const std::string& filename)
+{
+  lodepng_file_view_cleanup(&view);
+  return lodepng_view_file(&view, filename.c_str());
+}
+
+void FileView::release()
+{
+  lodepng_file_view_cleanup(&view);
+}
+
 unsigned load_file(std::vector<unsigned char>& buffer, const std::string& filename)
 {
   long size = lodepng_filesize(filename.c_str());
@@ -6055,7 +7928,7 @@ unsigned decompress(std::vector<unsigned char>& out, const unsigned char* in, si
 {
   unsigned char* buffer = 0;
   size_t buffersize = 0;
-  unsigned error = zlib_decompress(&buffer, &buffersize, in, insize, &settings);
+  unsigned error = zlib_decompress(&buffer, &buffersize, 0, in, insize, &settings, 0);
   if(buffer)
   {
     out.insert(out.end(), &buffer[0], &buffer[buffersize]);
@@ -6166,6 +8039,74 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
   return decode(out, w, h, state, in.empty() ? 0 : &in[0], in.size());
 }
 
+Arena::Arena()
+{
+  lodepng_arena_init(this);
+}
+
+Arena::~Arena()
+{
+  lodepng_arena_cleanup(this);
+}
+
+void Arena::reset()
+{
+  lodepng_arena_reset(this);
+}
+
+DecoderContext::DecoderContext()
+{
+  lodepng_decoder_context_init(this);
+}
+
+DecoderContext::~DecoderContext()
+{
+  lodepng_decoder_context_cleanup(this);
+}
+
+RowDecoder::RowDecoder() : decoder(0), rowbytes(0)
+{
+}
+
+RowDecoder::~RowDecoder()
+{
+  lodepng_row_decoder_finish(decoder);
+}
+
+unsigned RowDecoder::init(unsigned& w, unsigned& h, const unsigned char* in, size_t insize,
+                          LodePNGColorType colortype, unsigned bitdepth)
+{
+  lodepng_row_decoder_finish(decoder);
+  state.info_raw.colortype = colortype;
+  state.info_raw.bitdepth = bitdepth;
+  unsigned error = lodepng_row_decoder_init(&decoder, &w, &h, &state, in, insize);
+  rowbytes = error ? 0 : lodepng_get_raw_size(w, 1, &state.info_raw);
+  return error;
+}
+
+unsigned RowDecoder::init(unsigned& w, unsigned& h, const std::vector<unsigned char>& in,
+                          LodePNGColorType colortype, unsigned bitdepth)
+{
+  return init(w, h, in.empty() ? 0 : &in[0], in.size(), colortype, bitdepth);
+}
+
+unsigned RowDecoder::next_rows(std::vector<unsigned char>& out, unsigned n, unsigned& rows)
+{
+  rows = 0;
+  if(!decoder) return 0;
+  out.resize(n * rowbytes);
+  unsigned error = lodepng_row_decoder_next_rows(decoder, out.empty() ? 0 : &out[0], n, &rows);
+  out.resize(rows * rowbytes);
+  return error;
+}
+
+unsigned RowDecoder::finish()
+{
+  unsigned error = lodepng_row_decoder_finish(decoder);
+  decoder = 0;
+  return error;
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h, const std::string& filename,
                 LodePNGColorType colortype, unsigned bitdepth)
@@ -94,7 +94,13 @@ typedef enum LodePNGColorType
   LCT_RGB = 2, /*RGB: 8,16 bit*/
   LCT_PALETTE = 3, /*palette: 1,2,4,8 bit*/
   LCT_GREY_ALPHA = 4, /*greyscale with alpha: 8,16 bit*/
-  LCT_RGBA = 6 /*RGB with alpha: 8,16 bit*/
+  LCT_RGBA = 6, /*RGB with alpha: 8,16 bit*/
+  /*N64 texture formats, only for raw output (decoder info_raw, lodepng_convert's
+  mode_out), never in a PNG. Here bitdepth is the size of a whole texel, multi-byte
+  texels are big endian, and intensity is (r + g + b) / 3.*/
+  LCT_N64_RGBA = 16, /*16 bit: RGBA 5551 (alpha bit set if alpha > 0), 32 bit: RGBA 8888*/
+  LCT_N64_IA = 17, /*intensity with alpha, 8 bit: 4 + 4, 16 bit: 8 + 8*/
+  LCT_N64_I = 18 /*intensity, 4 or 8 bit, at 4 bit the first texel is the high nibble*/
 } LodePNGColorType;
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -513,6 +519,56 @@ unsigned lodepng_convert(unsigned char* out, const unsigned char* in,
                          unsigned w, unsigned h);
 
 #ifdef LODEPNG_COMPILE_DECODER
+/*
+Bump allocator for the temporary buffers of a decode: the zlib output, Huffman
+trees, scanlines and conversion tables. Set LodePNGDecoderSettings arena to use
+it, and call lodepng_arena_reset between images so the next one reuses the same
+memory. Allocations that don't fit go to the heap as usual, and the next reset
+grows the arena to the most that was asked for since the previous one, so after
+the largest image of a batch nearly every temporary buffer comes from it.
+What the caller keeps (the decoded image, info_png contents) is never placed in
+the arena. Reset it only when no row decoder using it is still open, and use one
+arena per thread. It only takes effect with the allocators built into lodepng.
+*/
+typedef struct LodePNGArena
+{
+  /*private*/
+  unsigned char* data;
+  size_t size; /*capacity of data*/
+  size_t used;
+  size_t last; /*offset of the most recent allocation, which can grow or shrink in place*/
+  size_t spilled; /*bytes that didn't fit and went to the heap since the last reset*/
+  size_t peak; /*the most of used plus spilled since the last reset*/
+} LodePNGArena;
+
+void lodepng_arena_init(LodePNGArena* arena);
+/*frees nothing given out before, only makes the memory available again; grows the arena if needed*/
+void lodepng_arena_reset(LodePNGArena* arena);
+void lodepng_arena_cleanup(LodePNGArena* arena);
+
+/*
+What the decoder keeps from one image to the next, for decoding many images: the
+fixed Huffman trees of deflate, a buffer for the IDAT data the size of the largest
+image so far, and an arena for the temporary buffers (used unless the settings
+name another one). The arena is reset automatically when a decode starts and no
+other decode with the context is in progress.
+Set LodePNGDecoderSettings context to use it. One context can serve any number
+of decodes in a row, including a row decoder and other decodes while it is open,
+but only from one thread at a time: use one per thread.
+*/
+typedef struct LodePNGDecoderContext
+{
+  /*private*/
+  LodePNGArena arena;
+  unsigned decoding; /*number of decodes with the context in progress*/
+  unsigned char* idat; /*spare buffer for the IDAT data, not in use by a decode*/
+  size_t idatsize; /*allocated size of idat*/
+  void* fixedtrees; /*deflate's fixed Huffman trees, built on first use*/
+} LodePNGDecoderContext;
+
+void lodepng_decoder_context_init(LodePNGDecoderContext* context);
+void lodepng_decoder_context_cleanup(LodePNGDecoderContext* context);
+
 /*
 Settings for the decoder. This contains settings for the PNG and the Zlib
 decoder, but not the Info settings from the Info structs.
@@ -528,6 +584,11 @@ typedef struct LodePNGDecoderSettings
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*arena for the decoder's temporary buffers, see LodePNGArena. Default: 0, the heap*/
+  LodePNGArena* arena;
+  /*buffers and tables kept between decodes, see LodePNGDecoderContext. Default: 0, none*/
+  LodePNGDecoderContext* context;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
   /*store all bytes from unknown chunks in the LodePNGInfo (off by default, useful for a png editor)*/
@@ -663,6 +724,27 @@ information is placed in the info_png field of the LodePNGState.
 unsigned lodepng_inspect(unsigned* w, unsigned* h,
                          LodePNGState* state,
                          const unsigned char* in, size_t insize);
+
+/*
+Decodes a PNG a few rows at a time, so the whole image doesn't have to be in
+memory at once. lodepng_row_decoder_init reads the chunks and allocates the
+decoder; each lodepng_row_decoder_next_rows call then decodes up to n more rows
+into out and sets rows to how many it decoded (0 at the end of the image). Rows
+are in the color type of state->info_raw (the PNG's own if color_convert is off),
+lodepng_get_raw_size(w, 1, &state->info_raw) bytes each, so w times their bits
+per pixel must be a multiple of 8 (error 95 otherwise).
+lodepng_row_decoder_finish checks the end of the zlib data and its checksum if
+all rows were read, and frees the decoder.
+Non-interlaced images are inflated and unfiltered on demand, holding two
+scanlines and the 32KB deflate window besides the compressed data. Interlaced
+images, and those with a custom zlib decoder, are decoded whole by init.
+state must stay valid until finish. On an init error the decoder is already freed.
+*/
+typedef struct LodePNGRowDecoder LodePNGRowDecoder;
+unsigned lodepng_row_decoder_init(LodePNGRowDecoder** decoder, unsigned* w, unsigned* h,
+                                  LodePNGState* state, const unsigned char* in, size_t insize);
+unsigned lodepng_row_decoder_next_rows(LodePNGRowDecoder* decoder, unsigned char* out, unsigned n, unsigned* rows);
+unsigned lodepng_row_decoder_finish(LodePNGRowDecoder* decoder);
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 
@@ -805,6 +887,30 @@ return value: error code (0 means ok)
 */
 unsigned lodepng_load_file(unsigned char** out, size_t* outsize, const char* filename);
 
+/*
+Read-only view of a whole file, see lodepng_view_file.
+*/
+typedef struct LodePNGFileView
+{
+  const unsigned char* data; /*the file's contents, 0 if it is empty*/
+  size_t size;
+  unsigned mapped; /*whether data is a memory mapping rather than an allocated copy*/
+} LodePNGFileView;
+
+/*
+Like lodepng_load_file, but regular files are memory mapped instead of read into
+an allocated buffer, so nothing is copied until the pages are touched. Pipes and
+other files that can't be mapped are read into an allocated buffer instead.
+view: output parameter, always initialized, release it with lodepng_file_view_cleanup
+filename: the path to the file to view
+return value: error code (0 means ok)
+The file should not be modified while it is being viewed.
+*/
+unsigned lodepng_view_file(LodePNGFileView* view, const char* filename);
+
+/*unmaps or frees the view's data, it is then empty*/
+void lodepng_file_view_cleanup(LodePNGFileView* view);
+
 /*
 Save a file from buffer to disk. Warning, if it exists, this function overwrites
 the file without warning!
@@ -838,6 +944,52 @@ unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
 unsigned decode(std::vector<unsigned char>& out, unsigned& w, unsigned& h,
                 State& state,
                 const std::vector<unsigned char>& in);
+
+/* A LodePNGArena that is freed when it goes out of scope. */
+class Arena : public LodePNGArena
+{
+  public:
+    Arena();
+    ~Arena();
+    void reset();
+  private:
+    Arena(const Arena&); /*not copyable*/
+    Arena& operator=(const Arena&);
+};
+
+/* A LodePNGDecoderContext that is freed when it goes out of scope. */
+class DecoderContext : public LodePNGDecoderContext
+{
+  public:
+    DecoderContext();
+    ~DecoderContext();
+  private:
+    DecoderContext(const DecoderContext&); /*not copyable*/
+    DecoderContext& operator=(const DecoderContext&);
+};
+
+/* Row by row decoding, see lodepng_row_decoder_init. */
+class RowDecoder
+{
+  public:
+    RowDecoder();
+    ~RowDecoder();
+    /*settings for the next init, e.g. the arena or context*/
+    LodePNGDecoderSettings& settings() { return state.decoder; }
+    unsigned init(unsigned& w, unsigned& h, const unsigned char* in, size_t insize,
+                  LodePNGColorType colortype = LCT_RGBA, unsigned bitdepth = 8);
+    unsigned init(unsigned& w, unsigned& h, const std::vector<unsigned char>& in,
+                  LodePNGColorType colortype = LCT_RGBA, unsigned bitdepth = 8);
+    /*replaces the contents of out with up to n decoded rows, rows is set to how many*/
+    unsigned next_rows(std::vector<unsigned char>& out, unsigned n, unsigned& rows);
+    unsigned finish();
+  private:
+    RowDecoder(const RowDecoder&); /*not copyable*/
+    RowDecoder& operator=(const RowDecoder&);
+    State state;
+    LodePNGRowDecoder* decoder;
+    size_t rowbytes;
+};
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_ENCODER
@@ -857,6 +1009,25 @@ return value: error code (0 means ok)
 */
 unsigned load_file(std::vector<unsigned char>& buffer, const std::string& filename);
 
+/*
+Read-only view of a file on disk, memory mapped where possible, see lodepng_view_file.
+The data stays valid until the next load, release or the destructor.
+*/
+class FileView
+{
+  public:
+    FileView();
+    ~FileView();
+    unsigned load(const std::string& filename);
+    void release();
+    const unsigned char* data() const { return view.data; }
+    size_t size() const { return view.size; }
+  private:
+    FileView(const FileView&); /*not copyable*/
+    FileView& operator=(const FileView&);
+    LodePNGFileView view;
+};
+
 /*
 Save the binary data in an std::vector to a file on disk. The file is overwritten
 without warning.
@@ -1288,6 +1459,8 @@ Supported color conversions:
 -anything to a palette, as long as the palette has the requested colors in it
 -removing alpha channel
 -higher to smaller bitdepth, and vice versa
+-anything to the N64 texture formats LCT_N64_RGBA (16, 32 bit), LCT_N64_IA (8, 16 bit)
+ and LCT_N64_I (4, 8 bit); these are output-only and cannot be encoded
 
 If you want no color conversion to be done (e.g. for speed or control):
 -In the encoder, you can make it save a PNG with any color type by giving the
@@ -6,24 +6,116 @@
  */
 
 #include <iostream>
-#include <sstream>
-#include <iomanip>
 #include <math.h>   
+#include <stdint.h>
+#include <string.h>
 #include <vector>
 #include <string>
 #include <fstream>
+#include <stdio.h>
 #include <chrono>
 #include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <stdlib.h>
+#include <dirent.h>
+#include <set>
+#include <map>
+#include <sys/stat.h>
 #include "lodepng.h"
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#endif
+
 
 using namespace std;
 
+/*
+Growable in-memory copy of an output file. The whole file is assembled
+here and handed to the OS in one go by save(), instead of flushing
+every line through an fstream
+ */
+class OutputBuffer {
+public:
+    // number of write calls issued by save(), reported by --stats
+    static atomic<size_t> writeCalls;
+    static atomic<size_t> bytesWritten;
+
+    OutputBuffer &operator<<(const string &s) {
+        data.append(s);
+        return *this;
+    }
+
+    OutputBuffer &operator<<(const char *s) {
+        data.append(s);
+        return *this;
+    }
+
+    OutputBuffer &operator<<(char c) {
+        data.push_back(c);
+        return *this;
+    }
+
+    OutputBuffer &operator<<(int n) {
+        data.append(to_string(n));
+        return *this;
+    }
+
+    OutputBuffer &operator<<(unsigned n) {
+        data.append(to_string(n));
+        return *this;
+    }
+
+    void write(const char *s, size_t n) {
+        data.append(s, n);
+    }
+
+    void append(const OutputBuffer &other) {
+        data.append(other.data);
+    }
+
+    void reserve(size_t n) {
+        data.reserve(n);
+    }
+
+    size_t size() const {
+        return data.size();
+    }
+
+    bool save(const string &path) const {
+        FILE *fp = fopen(path.c_str(), "w");
+        if (!fp) {
+            return false;
+        }
+
+        // unbuffered so the single fwrite goes straight to the OS
+        setvbuf(fp, NULL, _IONBF, 0);
+        size_t written = fwrite(data.data(), 1, data.size(), fp);
+        writeCalls++;
+        bytesWritten += written;
+
+        return (fclose(fp) == 0) && (written == data.size());
+    }
+
+private:
+    string data;
+};
+
+atomic<size_t> OutputBuffer::writeCalls(0);
+atomic<size_t> OutputBuffer::bytesWritten(0);
+
 /*
 Show ASCII art preview of the image
  */
 void displayPreview(const vector<unsigned char> &image,
-        unsigned w, unsigned h, fstream &f) {
+        unsigned w, unsigned h, OutputBuffer &f) {
     if (w > 0 && h > 0) {
         unsigned w2 = 48;
         if (w < w2) w2 = w;
@@ -33,7 +125,7 @@ void displayPreview(const vector<unsigned char> &image,
 
         f << '+';
         for (unsigned x = 0; x < w2; x++) f << '-';
-        f << '+' << endl;
+        f << '+' << '\n';
         for (unsigned y = 0; y < h2; y++) {
             f << "|";
             for (unsigned x = 0; x < w2; x++) {
@@ -61,355 +153,1539 @@ void displayPreview(const vector<unsigned char> &image,
                 f << (char) symbol;
             }
             f << "|";
-            f << endl;
+            f << '\n';
         }
         f << '+';
         for (unsigned x = 0; x < w2; x++) f << '-';
-        f << '+' << endl;
+        f << '+' << '\n';
     }
 }
 
+/*
+Lookup table with the two hex digits of every byte value so texels can be
+formatted a byte at a time without going through a stringstream
+ */
+struct HexTable {
+    char digits[256][2];
+
+    HexTable() {
+        const char *hex = "0123456789abcdef";
+        for (int i = 0; i < 256; i++) {
+            digits[i][0] = hex[i >> 4];
+            digits[i][1] = hex[i & 0xf];
+        }
+    }
+};
+
+static const HexTable hexTable;
+
+/*
+Write a texel as "0x" followed by sizeof(T)*2 zero padded hex digits,
+returns the position after the last digit written
+ */
 template<typename T>
-string T_to_hex(T i) {
-    stringstream stream;
-    stream << "0x"
-            << setfill('0') << setw(sizeof (T)*2)
-            << hex << i;
-    return stream.str();
+char *writeHex(char *out, T value) {
+    *out++ = '0';
+    *out++ = 'x';
+    for (int shift = (sizeof (T) - 1) * 8; shift >= 0; shift -= 8) {
+        memcpy(out, hexTable.digits[(value >> shift) & 0xff], 2);
+        out += 2;
+    }
+    return out;
 }
 
-int main(int argc, char *argv[]) {
+/*
+Read the big endian RGBA5551 texels the decoder produced
+ */
+void readTexels(const vector<unsigned char> &bytes, vector<uint16_t> &texels) {
+    texels.resize(bytes.size() / 2);
 
-    cout << "mksprite64 by Nathan Duma." << endl;
-    cout << "Convert png to c source file for the Nintendo 64, using the sprite & bitmap structure." << endl;
-    cout << "Type -h for usage" << endl;
-    if (argc == 1) {
-        cerr << "ERROR 1: no argument provided." << endl;
-        return 1;
+    for (size_t i = 0, p = 0; p < texels.size(); i += 2, p++) {
+        texels[p] = (bytes[i] << 8) | bytes[i + 1];
     }
+}
 
-    string file, filename, scaleX, scaleY, mode;
+/*
+Read the big endian RGBA8888 texels the decoder produced
+ */
+void readTexels(const vector<unsigned char> &bytes, vector<uint32_t> &texels) {
+    texels.resize(bytes.size() / 4);
 
-    scaleX = "1.0";
-    scaleY = "1.0";
-    mode = "16";
+    for (size_t i = 0, p = 0; p < texels.size(); i += 4, p++) {
+        uint32_t r = bytes[i];
+        uint32_t g = bytes[i + 1];
+        uint32_t b = bytes[i + 2];
+        uint32_t a = bytes[i + 3];
 
-    bool preview = false;
+        texels[p] = (r << 24) | (g << 16) | (b << 8) | a;
+    }
+}
 
+/*
+Width of a block trimmed to the columns of the image it covers, rounded
+up to whole TMEM lines of lineTexels
+ */
+unsigned trimmedWidth(unsigned columns, unsigned lineTexels) {
+    return (columns + lineTexels - 1) / lineTexels * lineTexels;
+}
 
-    // parse arguments
-    for (int i = 1; i < argc; i++) {
-        if ((i + 1) >= argc) {
-            cerr << "ERROR 2: argument-parameter mismatch" << endl;
-            return 2;
-        }
+/*
+Write the texel arrays of one band of blocks, from the rows of texels
+decoded for it, padding the blocks that hang off the right or bottom edge
+of the image with the padding text. With trimLine those blocks are cut to
+the rows left and to the columns left rounded up to a multiple of trimLine.
+With culled, the blocks whose texels are all isClear get no array and are
+marked in it
+ */
+template<typename T, typename Clear>
+void writeTexelBand(OutputBuffer &f, const vector<T> &texels,
+        unsigned width, unsigned rows, unsigned boxY, int texelW, int texelH,
+        const string &filename, const string &mode, const string &padding,
+        unsigned trimLine, Clear isClear, vector<char> *culled) {
+    int splitWidth = ceil((double) width / (double) texelW);
 
-        if ((argv[i][0] == '-') && (argv[i][1] != '\0')) {
-            if (argv[i][1] == 'h') {
-                cout << "Usage:" << endl;
-                cout << "Specify file path (must end in .png): -f file.png" << endl;
-                cout << "OPTIONAL:" << endl;
-                cout << "Scale in x direction: -sx scaleX" << endl;
-                cout << "Scale in y direction: -sy scaleY" << endl;
-                cout << "Scale is 1.0 by default." << endl;
-                cout << "n-bit mode (n=16 or n=32): -m n" << endl;
-                cout << "Mode is 16 by default." << endl;
-                cout << "Show preview in c file: -p t/f" << endl;
-                cout << "Preview is false by default." << endl;
-            } else if (argv[i][1] == 's' && (argv[i][2] != '\0')) {
-                if (argv[i][2] == 'x') {
-                    scaleX = argv[i + 1];
-                } else if (argv[i][2] == 'y') {
-                    scaleY = argv[i + 1];
-                } else {
-                    cerr << "ERROR 3: Unknown command: " << argv[i] << endl;
-                    return 3;
+    // one row of a block: tab + texelW * "0x..., " + newline
+    size_t lineSize = 2 + texelW * (max(sizeof (T) * 2, padding.size() - 2) + 4);
+    vector<char> line(lineSize);
+
+    for (int boxX = 0; boxX < splitWidth; boxX++) {
+        int i = boxY * splitWidth + boxX;
+
+        // the padding is transparent too, so only the image is checked
+        if (culled) {
+            unsigned endX = min(width, (unsigned) (boxX + 1) * texelW);
+            bool clear = true;
+            for (unsigned y = 0; y < rows && clear; y++) {
+                for (unsigned x = boxX * texelW; x < endX && clear; x++) {
+                    clear = isClear(texels[y * width + x]);
                 }
+            }
+            if (clear) {
+                (*culled)[i] = 1;
+                continue;
+            }
+        }
 
-                i++;
-            } else if (argv[i][1] == 'f') {
-                file = argv[i + 1];
-                // get the filename if it's a directory or not
-                size_t slashLocation = file.find_last_of("/\\");
-                size_t dotLocation = file.find_last_of(".");
+        // dummy aligner
+        f << "static Gfx " << filename << i
+                << "_C_dummy_aligner[] = { gsSPEndDisplayList() };" << '\n';
+        f << '\n';
 
-                filename = file.substr(
-                        slashLocation == string::npos ? 0 : slashLocation + 1,
-                        dotLocation == string::npos ? file.size() : dotLocation);
+        f << "u" << mode << " " << filename << i << "_sp" << "[] = {" << '\n';
 
-                i++;
-            } else if (argv[i][1] == 'p') {
-                if (argv[i + 1][0] == 't') {
-                    preview = true;
-                } else if (argv[i + 1][0] == 'f') {
-                    preview = false;
+        unsigned blockW = texelW, blockH = texelH;
+        if (trimLine) {
+            blockW = min(blockW, trimmedWidth(width - boxX * texelW, trimLine));
+            blockH = rows;
+        }
+
+        // now get the small texel from the band
+        for (unsigned y = 0; y < blockH; y++) {
+            char *out = line.data();
+            *out++ = '\t';
+            for (unsigned x = boxX * texelW; x < boxX * texelW + blockW; x++) {
+                if (y >= rows || x >= width) {
+                    memcpy(out, padding.data(), padding.size());
+                    out += padding.size();
                 } else {
-                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
-                    return 3;
-                }
-                i++;
-            } else if (argv[i][1] == 'm') {
-                mode = argv[i + 1];
-                // TODO: check for errors on this
-                if (!(mode == "16" || mode == "32")) {
-                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
-                    return 3;
+                    out = writeHex(out, texels[y * width + x]);
                 }
-                i++;
-            } else {
-                cerr << "ERROR 3: Unknown command: " << argv[i] << endl;
-                return 3;
+                *out++ = ',';
+                *out++ = ' ';
             }
+            *out++ = '\n';
+            f.write(line.data(), out - line.data());
         }
-    }
 
-    // decode the image
-    vector<unsigned char> png;
-    vector<unsigned char> image; //the raw pixels
-    vector<vector < string>> fullImage;
 
-    unsigned width, height;
+        f << '\n';
+        f << "};" << '\n';
 
+        f << '\n';
+        f << '\n';
+    }
+}
 
-    //load and decode
-    unsigned error = lodepng::load_file(png, file);
-    if (!error) {
-        error = lodepng::decode(image, width, height, png);
+/*
+Hands out the texels of the image band by band as the decoder converts
+them to the N64 format
+ */
+template<typename T>
+class DecodedBands {
+public:
+
+    DecodedBands(lodepng::RowDecoder &decoder) : decoder(decoder) {
     }
 
-    //if there's an error, display it
-    if (error) {
-        cout << "decoder error " << error << ": " << lodepng_error_text(error) << endl;
+    unsigned next(vector<T> &texels, unsigned count, unsigned &rows) {
+        unsigned error = decoder.next_rows(bytes, count, rows);
+        if (!error) {
+            readTexels(bytes, texels);
+        }
         return error;
     }
 
-
-    fullImage.resize(height);
-
-    for (auto &it : fullImage) {
-        it.resize(width);
+    unsigned finish() {
+        return decoder.finish();
     }
 
-    unsigned short colour_s;
-    unsigned int colour_i;
+private:
+    lodepng::RowDecoder &decoder;
+    vector<unsigned char> bytes;
+};
+
+/*
+Hands out the texels of an image already in memory band by band, the same
+way DecodedBands does
+ */
+template<typename T>
+class MemoryBands {
+public:
 
-    int row = 0;
-    int col = 0;
+    MemoryBands(const vector<T> &texels, unsigned width) : texels(texels), width(width) {
+    }
 
-    // we need to put the image into a 2D array
-    // so that we can make small sprites
-    // for the bitmap structure    
-    for (int i = 0; i < image.size(); i += 4) {
-        if (mode == "16") {
-            int r = image[i] / 8;
-            int g = image[i + 1] / 8;
-            int b = image[i + 2] / 8;
-            int a = (image[i + 3] > 0 ? 1 : 0);
+    unsigned next(vector<T> &band, unsigned count, unsigned &rows) {
+        size_t height = texels.size() / width;
+        rows = min((size_t) count, height - y);
+        band.assign(texels.begin() + y * width, texels.begin() + (y + rows) * width);
+        y += rows;
+        return 0;
+    }
 
-            colour_s = (r << 11) | (g << 6) | (b << 1) | a;
+    unsigned finish() {
+        return 0;
+    }
 
-            fullImage[row][col] = T_to_hex(colour_s);
-        } else {
-            int r = image[i];
-            int g = image[i + 1];
-            int b = image[i + 2];
-            int a = image[i + 3];
+private:
+    const vector<T> &texels;
+    unsigned width;
+    size_t y = 0;
+};
 
-            colour_i = (r << 24) | (g << 16) | (b << 8) | a;
-            fullImage[row][col] = T_to_hex(colour_i);
-        }
-        col++;
+/*
+Write one texel array per block, taking the image from the source one band
+of texelH rows at a time. With more than one thread, up to that many bands
+are decoded and then formatted at once, each into its own buffer, and the
+buffers are appended in band order so the file is the same as when
+written by one thread. Only those bands of texels are held in memory.
+culled, if given, has an entry per block and the fully transparent ones
+are dropped as in writeTexelBand
+ */
+template<typename T, typename Source, typename Clear>
+unsigned writeTexelArrays(OutputBuffer &f, Source &source,
+        unsigned width, unsigned height, int texelW, int texelH,
+        const string &filename, const string &mode, const string &padding,
+        unsigned trimLine, Clear isClear, vector<char> *culled, unsigned threads) {
+    int splitWidth = ceil((double) width / (double) texelW);
+    int splitHeight = ceil((double) height / (double) texelH);
 
-        if (col == width) {
-            row++;
-            col = 0;
-        }
+    size_t lineSize = 2 + texelW * (max(sizeof (T) * 2, padding.size() - 2) + 4);
+    size_t bandSize = splitWidth * (texelH * lineSize + 128);
+    f.reserve(splitHeight * bandSize);
 
+    if (threads > (unsigned) splitHeight) {
+        threads = splitHeight;
     }
 
+    if (threads <= 1) {
+        vector<T> texels;
 
+        for (int boxY = 0; boxY < splitHeight; boxY++) {
+            unsigned rows;
+            unsigned error = source.next(texels, texelH, rows);
+            if (error) {
+                return error;
+            }
 
+            writeTexelBand(f, texels, width, rows, boxY, texelW, texelH,
+                    filename, mode, padding, trimLine, isClear, culled);
+        }
+        return source.finish();
+    }
 
-    fstream f2("sp_" + filename + ".h", fstream::out);
-    fstream f("sp_" + filename + ".c", fstream::out);
+    vector<vector<T> > texels(threads);
+    vector<unsigned> rows(threads);
+    vector<OutputBuffer> parts(threads);
 
+    for (int firstY = 0; firstY < splitHeight; firstY += threads) {
+        unsigned count = min(threads, (unsigned) (splitHeight - firstY));
 
-    // have all of them included in 1 h file
-    // this isn't thread safe so you gotta get lucky
-    // otherwise you can sleep 
-    ofstream common("common_sprites.h", std::ios_base::app);
+        // the decoder can only go forward, so the bands are decoded here
+        for (unsigned b = 0; b < count; b++) {
+            unsigned error = source.next(texels[b], texelH, rows[b]);
+            if (error) {
+                return error;
+            }
+        }
 
-    common << "#include \"" << "sp_" << filename << ".h\"" << endl;
+        auto format = [&](unsigned b) {
+            parts[b] = OutputBuffer();
+            parts[b].reserve(bandSize);
+            writeTexelBand(parts[b], texels[b], width, rows[b], firstY + b,
+                    texelW, texelH, filename, mode, padding, trimLine, isClear, culled);
+        };
 
-    common.close();
+        vector<thread> pool;
+        for (unsigned b = 1; b < count; b++) {
+            pool.emplace_back(format, b);
+        }
+        format(0);
+        for (auto &it : pool) {
+            it.join();
+        }
 
-    f << "#include \"" << "sp_" + filename + ".h\"" << endl;
-    f << endl;
+        for (unsigned b = 0; b < count; b++) {
+            f.append(parts[b]);
+        }
+    }
+    return source.finish();
+}
 
-    // header
-    f2 << "#ifndef " << "sp_" << filename << "_h" << endl;
-    f2 << "#define " << "sp_" << filename << "_h" << endl;
-    f2 << endl;
-    f2 << "#include <PR/sp.h>" << endl;
+/*
+The TLUT of a colour indexed sprite and, for every RGBA5551 colour, the
+index of the TLUT entry it is drawn with
+ */
+struct Palette {
+    vector<uint16_t> colors;
+    vector<uint8_t> index = vector<uint8_t>(65536);
+    uint8_t padding = 0; // the entry the edge padding is filled with
+};
+
+/*
+A box of the median cut: the colours [begin, end) of the colour list, how
+many texels they cover and the channel with the largest range
+ */
+struct ColorBox {
+    size_t begin, end;
+    uint64_t count;
+    int channel;
+    unsigned range;
+};
 
-    f2 << endl;
+/*
+Red, green or blue of an RGBA5551 colour
+ */
+unsigned colorChannel(uint16_t color, int channel) {
+    return (color >> (11 - channel * 5)) & 31;
+}
 
+/*
+Count the texels of the box's colours and find the channel to split it on
+ */
+void measureBox(ColorBox &box, const vector<uint16_t> &colors, const vector<uint32_t> &histogram) {
+    unsigned low[3] = {31, 31, 31}, high[3] = {0, 0, 0};
+    box.count = 0;
+    for (size_t i = box.begin; i < box.end; i++) {
+        for (int c = 0; c < 3; c++) {
+            low[c] = min(low[c], colorChannel(colors[i], c));
+            high[c] = max(high[c], colorChannel(colors[i], c));
+        }
+        box.count += histogram[colors[i]];
+    }
+    box.channel = 0;
+    box.range = high[0] - low[0];
+    for (int c = 1; c < 3; c++) {
+        if (high[c] - low[c] > box.range) {
+            box.channel = c;
+            box.range = high[c] - low[c];
+        }
+    }
+}
 
+/*
+Pick the entry the padding is filled with: the one 0xfffe is drawn with
+when it is in the TLUT, else the first transparent entry, else the first
+ */
+void setPadding(Palette &palette, bool hasPadColor) {
+    if (hasPadColor) {
+        palette.padding = palette.index[0xfffe];
+        return;
+    }
+    auto clear = find_if(palette.colors.begin(), palette.colors.end(),
+            [](uint16_t color) { return !(color & 1); });
+    palette.padding = clear == palette.colors.end() ? 0 : clear - palette.colors.begin();
+}
 
-    // split it into texels
-    // use 32x32
-    int texelH = 32;
-    int texelW = 32;
+/*
+Build a TLUT of at most maxColors entries for the RGBA5551 texels. When
+the image has few enough colours the TLUT holds exactly those colours,
+otherwise they are reduced with a median cut weighted by texel count.
+Opaque and transparent colours are never mixed in one entry. padding is
+the number of texels the blocks hanging off the edge of the image are
+filled with. They are never drawn, so they only get a 0xfffe entry of their
+own when the image leaves one free, and otherwise reuse a transparent entry
+ */
+Palette buildPalette(const vector<uint16_t> &texels, size_t padding, unsigned maxColors) {
+    vector<uint32_t> histogram(65536);
+    for (uint16_t texel : texels) {
+        histogram[texel]++;
+    }
+    size_t distinct = 65536 - count(histogram.begin(), histogram.end(), 0u);
+    if (padding && !histogram[0xfffe] && distinct < maxColors) {
+        histogram[0xfffe] = padding;
+    }
 
-    int splitWidth = ceil((double) width / (double) texelW);
-    int splitHeight = ceil((double) height / (double) texelH);
+    // transparent colours first, each half sorted
+    vector<uint16_t> colors;
+    for (int alpha = 0; alpha < 2; alpha++) {
+        for (unsigned color = alpha; color < 65536; color += 2) {
+            if (histogram[color]) colors.push_back(color);
+        }
+    }
 
-    int totalBoxes = splitWidth*splitHeight;
+    Palette palette;
+    if (colors.size() <= maxColors) {
+        palette.colors = colors;
+        for (size_t i = 0; i < colors.size(); i++) {
+            palette.index[colors[i]] = i;
+        }
+        setPadding(palette, histogram[0xfffe] != 0);
+        return palette;
+    }
 
+    vector<ColorBox> boxes;
+    size_t opaque = find_if(colors.begin(), colors.end(),
+            [](uint16_t color) { return color & 1; }) - colors.begin();
+    if (opaque > 0) {
+        boxes.push_back({0, opaque, 0, 0, 0});
+    }
+    if (opaque < colors.size()) {
+        boxes.push_back({opaque, colors.size(), 0, 0, 0});
+    }
+    for (auto &box : boxes) {
+        measureBox(box, colors, histogram);
+    }
 
-    int boxX = 0;
-    int boxY = 0;
+    while (boxes.size() < maxColors) {
+        // split the box covering the most texels times its range
+        int best = -1;
+        uint64_t bestScore = 0;
+        for (size_t b = 0; b < boxes.size(); b++) {
+            uint64_t score = boxes[b].count * boxes[b].range;
+            if (boxes[b].end - boxes[b].begin > 1 && score > bestScore) {
+                best = b;
+                bestScore = score;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
 
-    f2 << "#define " << filename << "TRUEIMAGEH\t" << height << endl;
-    f2 << "#define " << filename << "TRUEIMAGEW\t" << width << endl;
-    f2 << "#define " << filename << "IMAGEH\t" << texelH * splitHeight << endl;
-    f2 << "#define " << filename << "IMAGEW\t" << texelW * splitWidth << endl;
-    f2 << "#define " << filename << "BLOCKSIZEW\t" << texelW << endl;
-    f2 << "#define " << filename << "BLOCKSIZEH\t" << texelH << endl;
-    f2 << "#define " << filename << "SCALEX\t" << scaleX << endl;
-    f2 << "#define " << filename << "SCALEY\t" << scaleY << endl;
-    //f << "#define " << filename << "ALPHABIT\t" << "255" << endl;
-    f2 << "#define " << filename << "MODE\t" << "SP_Z | SP_OVERLAP | SP_TRANSPARENT" << endl;
-    f2 << endl;
+        ColorBox box = boxes[best];
+        sort(colors.begin() + box.begin, colors.begin() + box.end,
+                [&](uint16_t a, uint16_t b) {
+                    unsigned ca = colorChannel(a, box.channel), cb = colorChannel(b, box.channel);
+                    return ca != cb ? ca < cb : a < b;
+                });
+
+        // weighted median, leaving at least one colour on each side
+        size_t split = box.begin;
+        uint64_t below = 0;
+        while (split < box.end - 1 && below + histogram[colors[split]] <= box.count / 2) {
+            below += histogram[colors[split++]];
+        }
+        if (split == box.begin) {
+            split++;
+        }
 
+        ColorBox upper = {split, box.end, 0, 0, 0};
+        box.end = split;
+        measureBox(box, colors, histogram);
+        measureBox(upper, colors, histogram);
+        boxes[best] = box;
+        boxes.push_back(upper);
+    }
 
-    f2 << "// extern varaibles " << endl;
-    f2 << "extern Bitmap " << filename << "_bitmaps[];" << endl;
-    f2 << "extern Gfx " << filename << "_dl[];" << endl;
-    f2 << endl;
-    f2 << "#define NUM_" << filename << "_BMS  (sizeof(" << filename << "_bitmaps" << ")/sizeof(Bitmap))" << endl;
-    f2 << endl;
-    f2 << "extern Sprite " << filename << "_sprite;" << endl;
-    f2 << endl;
+    // each entry is the average of its box
+    for (auto &box : boxes) {
+        uint64_t sum[3] = {0, 0, 0};
+        for (size_t i = box.begin; i < box.end; i++) {
+            for (int c = 0; c < 3; c++) {
+                sum[c] += (uint64_t) colorChannel(colors[i], c) * histogram[colors[i]];
+            }
+        }
+        uint16_t color = colors[box.begin] & 1;
+        for (int c = 0; c < 3; c++) {
+            color |= ((sum[c] + box.count / 2) / box.count) << (11 - c * 5);
+        }
+        palette.colors.push_back(color);
+    }
 
-    f2 << "#endif " << endl;
-    f2 << endl;
+    // and every colour is drawn with the nearest entry of the same alpha
+    for (uint16_t color : colors) {
+        unsigned bestDistance = ~0u;
+        for (size_t i = 0; i < palette.colors.size(); i++) {
+            if ((palette.colors[i] & 1) != (color & 1)) {
+                continue;
+            }
+            unsigned distance = 0;
+            for (int c = 0; c < 3; c++) {
+                int d = (int) colorChannel(color, c) - (int) colorChannel(palette.colors[i], c);
+                distance += d * d;
+            }
+            if (distance < bestDistance) {
+                bestDistance = distance;
+                palette.index[color] = i;
+            }
+        }
+    }
+    setPadding(palette, histogram[0xfffe] != 0);
+    return palette;
+}
 
-    // preview output
-    if (preview) {
-        f2 << "#if 0	/* Image preview */" << endl;
-        displayPreview(image, width, height, f2);
-        f2 << "#endif" << endl;
-        f2 << endl;
+/*
+Write the TLUT of a colour indexed sprite, 8 byte aligned like the texel
+arrays
+ */
+void writeTlut(OutputBuffer &f, const Palette &palette, const string &filename) {
+    f << "static Gfx " << filename << "_tlut_C_dummy_aligner[] = { gsSPEndDisplayList() };" << '\n';
+    f << '\n';
+
+    f << "u16 " << filename << "_tlut[] = {" << '\n';
+    char text[8];
+    for (size_t i = 0; i < palette.colors.size(); i += 16) {
+        f << '\t';
+        for (size_t j = i; j < min(i + 16, palette.colors.size()); j++) {
+            f.write(text, writeHex(text, palette.colors[j]) - text);
+            f << ", ";
+        }
+        f << '\n';
     }
+    f << '\n';
+    f << "};" << '\n';
 
-    for (int i = 0; i < totalBoxes; i++) {
-        //cout << "boxes: " << i << endl;
+    f << '\n';
+    f << '\n';
+}
 
-        vector<vector < string>> texel;
+/*
+Bits per texel of a -m mode
+ */
+unsigned texelSize(const string &mode) {
+    if (mode == "ci4") return 4;
+    if (mode == "ci8") return 8;
+    return mode == "32" ? 32 : 16;
+}
 
-        texel.resize(texelW);
+/*
+Texels of a -m mode in one 64-bit TMEM line; 32-bit texels take half a line
+in each half of TMEM
+ */
+unsigned lineTexels(const string &mode) {
+    return 64 / min(texelSize(mode), 16u);
+}
 
-        for (auto &it : texel) {
-            it.resize(texelH);
+/*
+Pick the block size that draws the image with the fewest RDP tile loads,
+then with the least padding, then the squarest. A block has to fit the 4 KB of TMEM, or the
+2 KB left next to the TLUT for the colour indexed modes. Its width is a
+power of two of at least one 64-bit TMEM line, so LoadBlock steps to the
+next line exactly, and at most 1024 texels, the reach of the RDP's texture
+coordinates, and 511 lines, the most a tile descriptor holds. The height
+is spread evenly over the bands of blocks
+ */
+void chooseBlockSize(unsigned width, unsigned height, const string &mode, int &texelW, int &texelH) {
+    unsigned bits = texelSize(mode);
+    unsigned tmemBits = (bits <= 8 ? 2048 : 4096) * 8;
+    unsigned maxTexels = tmemBits / bits;
+    unsigned line = lineTexels(mode);
+    unsigned maxWidth = min(min(maxTexels, 1024u), 511 * line);
+
+    unsigned bestLoads = ~0u;
+    unsigned long long bestArea = ~0ull;
+    for (unsigned w = line; w <= maxWidth; w *= 2) {
+        unsigned across = (width + w - 1) / w;
+        unsigned down = (height + maxTexels / w - 1) / (maxTexels / w);
+        unsigned h = (height + down - 1) / down;
+
+        unsigned loads = across * down;
+        unsigned long long area = (unsigned long long) across * w * down * h;
+        if (loads < bestLoads || (loads == bestLoads && (area < bestArea
+                || (area == bestArea && max(w, h) < (unsigned) max(texelW, texelH))))) {
+            bestLoads = loads;
+            bestArea = area;
+            texelW = w;
+            texelH = h;
         }
 
-        row = 0;
-        col = 0;
-
-        // now get the small texel form the big image
-        for (int i = boxX * texelW; i < ((boxX * texelW) + texelW); i++) {
-            for (int j = boxY * texelH; j < ((boxY * texelH) + texelH); j++) {
-                if (i >= fullImage.size() ||
-                        j >= fullImage[0].size()) {
-                    //cout << "true" << endl;
-                    texel[row][col] = "0xfffe";
-                } else {
-                    texel[row][col] = fullImage[i][j];
-                }
-                //cout << "row: " << row << " col: " << col << endl;
-                col++;
-            }
-            row++;
-            col = 0;
+        // wider blocks would only add padding
+        if (w >= width) {
+            break;
         }
+    }
+}
 
+/*
+Options shared by every sprite converted in one run
+ */
+struct SpriteOptions {
+    string scaleX = "1.0";
+    string scaleY = "1.0";
+    string mode = "16";
+    bool preview = false;
+    bool sortedCommon = false;
+    bool incremental = false;
+    bool autoBlocks = false; // block size from TMEM instead of 32x32
+    bool trimEdges = false; // edge blocks cut to the image instead of padded
+    bool cullClear = false; // fully transparent blocks dropped
+    // threads formatting the blocks of one sprite, more than one when
+    // there are fewer sprites than threads; doesn't change the output
+    unsigned tileThreads = 1;
+};
 
-        // dummy aligner
-        f << "static Gfx " << filename << i
-                << "_C_dummy_aligner[] = { gsSPEndDisplayList() };" << endl;
-        f << endl;
+/*
+The options that change the generated sources, recorded in the manifest so
+sprites are converted again when they change
+ */
+string optionsKey(const SpriteOptions &options) {
+    return "sx=" + options.scaleX + " sy=" + options.scaleY
+            + " m=" + options.mode + " p=" + (options.preview ? "t" : "f")
+            + " b=" + (options.autoBlocks ? "a" : "f") + " e=" + (options.trimEdges ? "t" : "f")
+            + " t=" + (options.cullClear ? "t" : "f");
+}
 
-        f << "u" << mode << " " << filename << i << "_sp" << "[] = {" << endl;
+/*
+What the manifest records about the last conversion of one sprite
+ */
+struct ManifestEntry {
+    string hash; // of the png's contents
+    string options; // optionsKey() of the run that converted it
+    unsigned long long cSize = 0; // sizes of sp_<name>.c/.h, to notice outputs
+    unsigned long long hSize = 0; // that were edited or deleted since
+};
 
-        // output stuff here
-        for (auto &it : texel) {
-            f << "\t";
-            for (auto &it2 : it) {
-                f << it2 << ", ";
-            }
-            f << endl;
-        }
+// sprite name -> its entry
+typedef map<string, ManifestEntry> Manifest;
+
+/*
+One png to convert, and the result of converting it
+ */
+struct SpriteJob {
+    string file;
+    string name;
+    unsigned error = 0;
+    string message;
+    bool skipped = false; // unchanged since the manifest was written
+    unsigned loads = 0; // RDP loads to draw it: one per block, one for a TLUT
+    ManifestEntry result; // what to record in the manifest if it converted
+};
 
+/*
+Get the sprite name from a file path, without the directory or extension
+ */
+string spriteName(const string &file) {
+    size_t slashLocation = file.find_last_of("/\\");
+    size_t start = (slashLocation == string::npos ? 0 : slashLocation + 1);
+    size_t dotLocation = file.find_last_of(".");
 
-        f << endl;
-        f << "};" << endl;
+    if (dotLocation == string::npos || dotLocation < start) {
+        dotLocation = file.size();
+    }
 
-        f << endl;
-        f << endl;
+    return file.substr(start, dotLocation - start);
+}
 
-        boxY++;
+/*
+Add every .png in a directory to the list of files, sorted by name so the
+order doesn't depend on the file system
+ */
+bool listDirectory(const string &dir, vector<string> &files) {
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        return false;
+    }
 
-        if (boxY == splitWidth) {
-            boxX++;
-            boxY = 0;
+    vector<string> found;
+    while (dirent *entry = readdir(d)) {
+        string name = entry->d_name;
+        if (name.size() > 4) {
+            string ext = name.substr(name.size() - 4);
+            for (auto &c : ext) c = tolower(c);
+            if (ext == ".png") {
+                found.push_back(dir + "/" + name);
+            }
         }
     }
+    closedir(d);
 
-    f << endl << endl;
-
-
-    f << "Bitmap " << filename << "_bitmaps[] = {" << endl;
-    for (int i = 0; i < totalBoxes; i++) {
-        f << "\t";
-        f << "{" << filename << "BLOCKSIZEW" << ", " 
-                << filename << "BLOCKSIZEW" << ", 0, 0, " 
-                << filename << i << "_sp, " 
-                << filename << "BLOCKSIZEH" << ", 0},";
-        f << endl;
-    }
-
-    f << "};" << endl;
-    f << endl;
-
-    f << "Gfx " << filename << "_dl[NUM_DL(NUM_" << filename << "_BMS)];" << endl;
-    f << endl;
-
-    f << "Sprite " << filename << "_sprite = {" << endl;
-    f << "\t" << "0, 0, /* Position: x,y */" << endl;
-    f << "\t" << filename << "IMAGEW" << ", " << filename << "IMAGEH" << ", /* Sprite size in texels (x,y) */" << endl;
-    f << "\t" << filename << "SCALEX" << ", " << filename << "SCALEY" << ", /* Sprite Scale: x,y */" << endl;
-    f << "\t" << "0, 0, /* Sprite Explosion Spacing: x,y */" << endl;
-    f << "\t" << filename << "MODE" << ", /* Sprite Attributes */" << endl;
-    f << "\t" << "0x1234, /* Sprite Depth: Z */" << endl;
-    f << "\t" << "255, 255, 255, 255, /* Sprite Coloration: RGBA */" << endl;
-    f << "\t" << "0, 0, NULL, /* Color LookUp Table: start_index, length, address */" << endl;
-    f << "\t" << "0, 1, /* Sprite Bitmap index: start index, step increment */" << endl;
-    f << "\t" << "NUM_" << filename << "_BMS, /* Number of bitmaps */" << endl;
-    f << "\t" << "NUM_DL(" << "NUM_" << filename << "_BMS), /* Number of display list locations allocated */" << endl;
-    f << "\t" << filename << "BLOCKSIZEH" << ", " << filename << "BLOCKSIZEH" << ", /* Sprite Bitmap Height: Used_height, physical height */" << endl;
-    f << "\t" << "G_IM_FMT_RGBA, /* Sprite Bitmap Format */" << endl;
-    f << "\t" << "G_IM_SIZ_" << mode << "b, /* Sprite Bitmap Texel Size */" << endl;
-    f << "\t" << filename << "_bitmaps, /* Pointer to bitmaps */" << endl;
-    f << "\t" << filename << "_dl, /* Display list memory */" << endl;
-    f << "\t" << "NULL, /* next_dl pointer */" << endl;
-    f << "};" << endl;
-
-    f << endl;
-
-
-    f.close();
-
-    return 0;
+    sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+    return true;
 }
 
+/*
+Add the files named in a list file, one path per line. Blank lines and
+lines starting with # are ignored
+ */
+bool readListFile(const string &path, vector<string> &files) {
+    ifstream list(path);
+    if (!list) {
+        return false;
+    }
+
+    string line;
+    while (getline(list, line)) {
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        if (!line.empty() && line[0] != '#') {
+            files.push_back(line);
+        }
+    }
+    return true;
+}
+
+/*
+Record a lodepng error on the job
+ */
+static void setDecoderError(SpriteJob &job, unsigned error) {
+    job.error = error;
+    job.message = "decoder error " + to_string(error) + ": " + lodepng_error_text(error);
+}
+
+/*
+64 bit FNV-1a hash of the png's contents, as hex
+ */
+string contentHash(const unsigned char *data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+
+    char text[17];
+    for (int i = 15; i >= 0; i--) {
+        text[i] = "0123456789abcdef"[hash & 0xf];
+        hash >>= 4;
+    }
+    text[16] = '\0';
+    return text;
+}
+
+/*
+Size of a file, or false if it doesn't exist
+ */
+bool fileSize(const string &path, unsigned long long &size) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    size = st.st_size;
+    return true;
+}
+
+/*
+Whether the sources the manifest recorded for the job are still there and
+were generated from the same png with the same options
+ */
+bool isUnchanged(const SpriteJob &job, const Manifest &manifest) {
+    auto it = manifest.find(job.name);
+    if (it == manifest.end()) {
+        return false;
+    }
+
+    const ManifestEntry &entry = it->second;
+    unsigned long long cSize, hSize;
+    return entry.hash == job.result.hash && entry.options == job.result.options
+            && fileSize("sp_" + job.name + ".c", cSize) && cSize == entry.cSize
+            && fileSize("sp_" + job.name + ".h", hSize) && hSize == entry.hSize;
+}
+
+/*
+Decode one png and write its sp_<name>.c and sp_<name>.h files. context keeps
+the decoder's tables and buffers from the previous sprites of this thread.
+In incremental mode sprites the previous manifest says are unchanged are only
+hashed, not decoded
+ */
+void convertSprite(SpriteJob &job, const SpriteOptions &options,
+        lodepng::DecoderContext &context, const Manifest &previous) {
+    const string &filename = job.name;
+
+    // decode the image
+    lodepng::FileView png; //the file, mapped read-only rather than copied
+    vector<unsigned char> image; //the raw pixels, only for the preview
+
+    unsigned width, height;
+
+
+    // the decoder converts straight to the N64 texel format and hands
+    // out the rows band by band while the texel arrays are written
+    lodepng::RowDecoder decoder;
+    decoder.settings().context = &context;
+    // the colour indexed modes start from RGBA5551 too
+    unsigned texelBits = options.mode == "32" ? 32 : 16;
+    bool indexed = options.mode == "ci4" || options.mode == "ci8";
+
+    //load and decode
+    unsigned error = png.load(job.file);
+    if (!error && options.incremental) {
+        job.result.hash = contentHash(png.data(), png.size());
+        job.result.options = optionsKey(options);
+        if (isUnchanged(job, previous)) {
+            job.skipped = true;
+            job.result = previous.find(job.name)->second;
+            return;
+        }
+    }
+    if (!error) {
+        error = decoder.init(width, height, png.data(), png.size(), LCT_N64_RGBA, texelBits);
+    }
+    if (!error && options.preview) {
+        lodepng::State state;
+        state.decoder.context = &context;
+        error = lodepng::decode(image, width, height, state, png.data(), png.size());
+    }
+
+    //if there's an error, display it
+    if (error) {
+        setDecoderError(job, error);
+        return;
+    }
+
+    png.release();
+
+
+
+    OutputBuffer f2;
+    OutputBuffer f;
+
+
+    f << "#include \"" << "sp_" + filename + ".h\"" << '\n';
+    f << '\n';
+
+    // header
+    f2 << "#ifndef " << "sp_" << filename << "_h" << '\n';
+    f2 << "#define " << "sp_" << filename << "_h" << '\n';
+    f2 << '\n';
+    f2 << "#include <PR/sp.h>" << '\n';
+
+    f2 << '\n';
+
+
+
+    // split it into texels
+    // use 32x32 unless the block size is picked from TMEM
+    int texelH = 32;
+    int texelW = 32;
+    if (options.autoBlocks) {
+        chooseBlockSize(width, height, options.mode, texelW, texelH);
+    }
+
+    int splitWidth = ceil((double) width / (double) texelW);
+    int splitHeight = ceil((double) height / (double) texelH);
+
+    int totalBoxes = splitWidth*splitHeight;
+
+    // with trimmed edges the last column and row of blocks only cover the
+    // image, their columns rounded up to whole TMEM lines
+    unsigned trimLine = options.trimEdges ? lineTexels(options.mode) : 0;
+    unsigned lastW = texelW, lastH = texelH;
+    if (trimLine) {
+        lastW = min((unsigned) texelW, trimmedWidth(width - (splitWidth - 1) * texelW, trimLine));
+        lastH = height - (splitHeight - 1) * texelH;
+    }
+
+    // the TLUT needs the colours of the whole image, so the colour indexed
+    // modes decode it all before writing anything
+    Palette palette;
+    vector<uint8_t> indices;
+    if (indexed) {
+        DecodedBands<uint16_t> bands(decoder);
+        vector<uint16_t> texels;
+        unsigned rows;
+        error = bands.next(texels, height, rows);
+        if (!error) {
+            error = bands.finish();
+        }
+        if (error) {
+            setDecoderError(job, error);
+            return;
+        }
+
+        size_t padding = (size_t) ((splitWidth - 1) * texelW + lastW)
+                * ((splitHeight - 1) * texelH + lastH) - texels.size();
+        palette = buildPalette(texels, padding, options.mode == "ci4" ? 16 : 256);
+
+        if (options.mode == "ci8") {
+            indices.resize(texels.size());
+            for (size_t i = 0; i < texels.size(); i++) {
+                indices[i] = palette.index[texels[i]];
+            }
+        } else {
+            // two texels a byte, the left one in the high nibble
+            unsigned pairs = (width + 1) / 2;
+            indices.resize(pairs * height);
+            for (unsigned y = 0; y < height; y++) {
+                for (unsigned x = 0; x < pairs; x++) {
+                    uint8_t right = 2 * x + 1 < width ? palette.index[texels[y * width + 2 * x + 1]]
+                            : palette.padding;
+                    indices[y * pairs + x] = (palette.index[texels[y * width + 2 * x]] << 4) | right;
+                }
+            }
+        }
+    }
+
+    // the texel arrays come first, the header needs to know which blocks
+    // were dropped for being fully transparent
+    vector<char> culled(totalBoxes);
+    vector<char> *cull = options.cullClear ? &culled : nullptr;
+    if (indexed) {
+        writeTlut(f, palette, filename);
+
+        // padding is the palette's padding entry, in both nibbles for ci4
+        char padding[8];
+        uint8_t pad = palette.padding;
+        vector<char> clear(256);
+        for (unsigned i = 0; i < palette.colors.size(); i++) {
+            clear[i] = !(palette.colors[i] & 1);
+        }
+        if (options.mode == "ci8") {
+            MemoryBands<uint8_t> bands(indices, width);
+            error = writeTexelArrays<uint8_t>(f, bands, width, height, texelW, texelH, filename, "8",
+                    string(padding, writeHex(padding, pad)), trimLine,
+                    [&clear](uint8_t index) { return clear[index] != 0; }, cull, options.tileThreads);
+        } else {
+            MemoryBands<uint8_t> bands(indices, (width + 1) / 2);
+            error = writeTexelArrays<uint8_t>(f, bands, (width + 1) / 2, height, texelW / 2, texelH, filename, "8",
+                    string(padding, writeHex(padding, (uint8_t) (pad << 4 | pad))), trimLine / 2,
+                    [&clear](uint8_t pair) { return clear[pair >> 4] && clear[pair & 0xf]; }, cull,
+                    options.tileThreads);
+        }
+    } else if (options.mode == "16") {
+        DecodedBands<uint16_t> bands(decoder);
+        error = writeTexelArrays<uint16_t>(f, bands, width, height, texelW, texelH, filename, options.mode,
+                "0xfffe", trimLine, [](uint16_t texel) { return !(texel & 1); }, cull, options.tileThreads);
+    } else {
+        DecodedBands<uint32_t> bands(decoder);
+        error = writeTexelArrays<uint32_t>(f, bands, width, height, texelW, texelH, filename, options.mode,
+                "0xfffe", trimLine, [](uint32_t texel) { return !(texel & 0xff); }, cull, options.tileThreads);
+    }
+    if (error) {
+        setDecoderError(job, error);
+        return;
+    }
+
+    unsigned drawn = totalBoxes - count(culled.begin(), culled.end(), 1);
+    job.loads = drawn + (indexed ? 1 : 0);
+
+
+    f2 << "#define " << filename << "TRUEIMAGEH\t" << height << '\n';
+    f2 << "#define " << filename << "TRUEIMAGEW\t" << width << '\n';
+    f2 << "#define " << filename << "IMAGEH\t" << (trimLine ? height : texelH * splitHeight) << '\n';
+    f2 << "#define " << filename << "IMAGEW\t" << (trimLine ? width : texelW * splitWidth) << '\n';
+    f2 << "#define " << filename << "BLOCKSIZEW\t" << texelW << '\n';
+    f2 << "#define " << filename << "BLOCKSIZEH\t" << texelH << '\n';
+    f2 << "#define " << filename << "SCALEX\t" << options.scaleX << '\n';
+    f2 << "#define " << filename << "SCALEY\t" << options.scaleY << '\n';
+    //f << "#define " << filename << "ALPHABIT\t" << "255" << endl;
+    f2 << "#define " << filename << "MODE\t" << "SP_Z | SP_OVERLAP | SP_TRANSPARENT" << '\n';
+    if (indexed) {
+        f2 << "#define " << filename << "TLUTSIZE\t" << (unsigned) palette.colors.size() << '\n';
+    }
+    if (options.autoBlocks) {
+        f2 << "#define " << filename << "TILELOADS\t" << job.loads << '\n';
+    }
+    f2 << '\n';
+
+
+    f2 << "// extern varaibles " << '\n';
+    f2 << "extern Bitmap " << filename << "_bitmaps[];" << '\n';
+    f2 << "extern Gfx " << filename << "_dl[];" << '\n';
+    if (indexed) {
+        f2 << "extern u16 " << filename << "_tlut[];" << '\n';
+    }
+    f2 << '\n';
+    f2 << "#define NUM_" << filename << "_BMS  (sizeof(" << filename << "_bitmaps" << ")/sizeof(Bitmap))" << '\n';
+    if (options.cullClear) {
+        // the bitmaps of dropped blocks are skipped, so they need no display list
+        f2 << "#define NUM_" << filename << "_DRAWN  " << drawn << '\n';
+    }
+    f2 << '\n';
+    f2 << "extern Sprite " << filename << "_sprite;" << '\n';
+    f2 << '\n';
+
+    f2 << "#endif " << '\n';
+    f2 << '\n';
+
+    // preview output
+    if (options.preview) {
+        f2 << "#if 0	/* Image preview */" << '\n';
+        displayPreview(image, width, height, f2);
+        f2 << "#endif" << '\n';
+        f2 << '\n';
+    }
+
+    f << '\n' << '\n';
+
+
+    f << "Bitmap " << filename << "_bitmaps[] = {" << '\n';
+    for (int i = 0; i < totalBoxes; i++) {
+        // trimmed edge blocks draw only the columns of the image they cover,
+        // while their rows are stored lastW texels apart
+        string blockW = filename + "BLOCKSIZEW", imageW = blockW;
+        string blockH = filename + "BLOCKSIZEH";
+        unsigned columns = width - i % splitWidth * texelW;
+        if (trimLine && columns < (unsigned) texelW) {
+            blockW = to_string(columns);
+            imageW = to_string(lastW);
+        }
+        if (trimLine && i / splitWidth == splitHeight - 1 && lastH < (unsigned) texelH) {
+            blockH = to_string(lastH);
+        }
+
+        // a NULL buffer keeps the spacing but is never loaded or drawn
+        string buffer = culled[i] ? string("NULL") : filename + to_string(i) + "_sp";
+
+        f << "\t";
+        f << "{" << blockW << ", " 
+                << imageW << ", 0, 0, " 
+                << buffer << ", " 
+                << blockH << ", 0},";
+        f << '\n';
+    }
+
+    f << "};" << '\n';
+    f << '\n';
+
+    string numDrawn = "NUM_" + filename + (options.cullClear ? "_DRAWN" : "_BMS");
+    f << "Gfx " << filename << "_dl[NUM_DL(" << numDrawn << ")];" << '\n';
+    f << '\n';
+
+    f << "Sprite " << filename << "_sprite = {" << '\n';
+    f << "\t" << "0, 0, /* Position: x,y */" << '\n';
+    f << "\t" << filename << "IMAGEW" << ", " << filename << "IMAGEH" << ", /* Sprite size in texels (x,y) */" << '\n';
+    f << "\t" << filename << "SCALEX" << ", " << filename << "SCALEY" << ", /* Sprite Scale: x,y */" << '\n';
+    f << "\t" << "0, 0, /* Sprite Explosion Spacing: x,y */" << '\n';
+    f << "\t" << filename << "MODE" << ", /* Sprite Attributes */" << '\n';
+    f << "\t" << "0x1234, /* Sprite Depth: Z */" << '\n';
+    f << "\t" << "255, 255, 255, 255, /* Sprite Coloration: RGBA */" << '\n';
+    if (indexed) {
+        f << "\t" << "0, " << filename << "TLUTSIZE, (int *) " << filename << "_tlut, /* Color LookUp Table: start_index, length, address */" << '\n';
+    } else {
+        f << "\t" << "0, 0, NULL, /* Color LookUp Table: start_index, length, address */" << '\n';
+    }
+    f << "\t" << "0, 1, /* Sprite Bitmap index: start index, step increment */" << '\n';
+    f << "\t" << "NUM_" << filename << "_BMS, /* Number of bitmaps */" << '\n';
+    f << "\t" << "NUM_DL(" << numDrawn << "), /* Number of display list locations allocated */" << '\n';
+    f << "\t" << filename << "BLOCKSIZEH" << ", " << filename << "BLOCKSIZEH" << ", /* Sprite Bitmap Height: Used_height, physical height */" << '\n';
+    f << "\t" << (indexed ? "G_IM_FMT_CI" : "G_IM_FMT_RGBA") << ", /* Sprite Bitmap Format */" << '\n';
+    f << "\t" << "G_IM_SIZ_" << (indexed ? options.mode.substr(2) : options.mode) << "b, /* Sprite Bitmap Texel Size */" << '\n';
+    f << "\t" << filename << "_bitmaps, /* Pointer to bitmaps */" << '\n';
+    f << "\t" << filename << "_dl, /* Display list memory */" << '\n';
+    f << "\t" << "NULL, /* next_dl pointer */" << '\n';
+    f << "};" << '\n';
+
+    f << '\n';
+
+
+    if (!f2.save("sp_" + filename + ".h") || !f.save("sp_" + filename + ".c")) {
+        job.error = 4;
+        job.message = "ERROR 4: unable to write sp_" + filename + ".c/.h";
+    }
+    job.result.cSize = f.size();
+    job.result.hSize = f2.size();
+}
+
+/*
+Exclusive advisory lock on a file next to the one being updated, so that
+several mkspriten64 processes can share common_sprites.h
+ */
+class FileLock {
+public:
+
+    FileLock(const string &path) {
+#ifdef _WIN32
+        handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS,
+                FILE_ATTRIBUTE_NORMAL, NULL);
+        OVERLAPPED overlapped = {};
+        locked = (handle != INVALID_HANDLE_VALUE) &&
+                LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+#else
+        fd = open(path.c_str(), O_RDWR | O_CREAT, 0666);
+        locked = (fd >= 0) && (flock(fd, LOCK_EX) == 0);
+#endif
+    }
+
+    ~FileLock() {
+#ifdef _WIN32
+        if (handle != INVALID_HANDLE_VALUE) {
+            OVERLAPPED overlapped = {};
+            if (locked) UnlockFileEx(handle, 0, 1, 0, &overlapped);
+            CloseHandle(handle);
+        }
+#else
+        if (fd >= 0) {
+            if (locked) flock(fd, LOCK_UN);
+            close(fd);
+        }
+#endif
+    }
+
+    bool isLocked() const {
+        return locked;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE handle;
+#else
+    int fd;
+#endif
+    bool locked;
+};
+
+/*
+Replace path with the contents of tmpPath in one step, so readers only
+ever see the old or the new file
+ */
+bool replaceFile(const string &tmpPath, const string &path) {
+#ifdef _WIN32
+    return MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(tmpPath.c_str(), path.c_str()) == 0;
+#endif
+}
+
+/*
+Merge the include lines into the existing common header, keeping them
+sorted and without duplicates so the file only depends on which sprites
+were converted, not on the order or how many times. The new file is
+written next to the old one and renamed over it while holding the lock.
+A file that already holds exactly these lines is left untouched
+ */
+bool writeSortedCommonHeader(const string &path, const vector<string> &includes) {
+    FileLock lock(path + ".lock");
+    if (!lock.isLocked()) {
+        return false;
+    }
+
+    set<string> lines(includes.begin(), includes.end());
+
+    ifstream existing(path);
+    string line, previous;
+    while (getline(existing, line)) {
+        previous += line + '\n';
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        if (!line.empty()) {
+            lines.insert(line);
+        }
+    }
+    existing.close();
+
+    string merged;
+    for (auto &it : lines) {
+        merged += it + '\n';
+    }
+
+    // nothing new to include, so leave the file and its timestamp alone
+    if (merged == previous) {
+        return true;
+    }
+
+    OutputBuffer common;
+    common << merged;
+
+#ifdef _WIN32
+    string tmpPath = path + ".tmp" + to_string(GetCurrentProcessId());
+#else
+    string tmpPath = path + ".tmp" + to_string(getpid());
+#endif
+    if (!common.save(tmpPath)) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+
+    if (!replaceFile(tmpPath, path)) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+static const char *manifestPath = "mksprite64.manifest";
+static const char *manifestHeader = "# mksprite64 manifest 1";
+
+/*
+Read the manifest of an earlier incremental run. A missing or unreadable
+manifest just means every sprite is converted
+ */
+void readManifest(const string &path, Manifest &manifest) {
+    ifstream in(path);
+    string line;
+    if (!getline(in, line) || line != manifestHeader) {
+        return;
+    }
+
+    // name, hash, c size, h size and options, separated by tabs
+    while (getline(in, line)) {
+        size_t t1 = line.find('\t');
+        size_t t2 = line.find('\t', t1 + 1);
+        size_t t3 = line.find('\t', t2 + 1);
+        size_t t4 = line.find('\t', t3 + 1);
+        if (t1 == string::npos || t2 == string::npos
+                || t3 == string::npos || t4 == string::npos) {
+            continue;
+        }
+
+        ManifestEntry &entry = manifest[line.substr(0, t1)];
+        entry.hash = line.substr(t1 + 1, t2 - t1 - 1);
+        entry.cSize = strtoull(line.c_str() + t2 + 1, NULL, 10);
+        entry.hSize = strtoull(line.c_str() + t3 + 1, NULL, 10);
+        entry.options = line.substr(t4 + 1);
+    }
+}
+
+/*
+Record the sprites of this run in the manifest, keeping the entries of
+sprites that weren't part of it. Sprites that failed, or were converted
+without being hashed because the run wasn't incremental, are removed so
+they are converted again next time. Like the sorted common header, the manifest
+is re-read and replaced while holding a lock so instances can share it
+ */
+bool writeManifest(const string &path, const vector<SpriteJob> &jobs) {
+    FileLock lock(path + ".lock");
+    if (!lock.isLocked()) {
+        return false;
+    }
+
+    Manifest manifest;
+    readManifest(path, manifest);
+    for (auto &it : jobs) {
+        if (it.error || it.result.hash.empty()) {
+            manifest.erase(it.name);
+        } else {
+            manifest[it.name] = it.result;
+        }
+    }
+
+    OutputBuffer out;
+    out << manifestHeader << '\n';
+    for (auto &it : manifest) {
+        out << it.first << '\t' << it.second.hash << '\t'
+                << to_string(it.second.cSize) << '\t' << to_string(it.second.hSize) << '\t'
+                << it.second.options << '\n';
+    }
+
+#ifdef _WIN32
+    string tmpPath = path + ".tmp" + to_string(GetCurrentProcessId());
+#else
+    string tmpPath = path + ".tmp" + to_string(getpid());
+#endif
+    if (!out.save(tmpPath) || !replaceFile(tmpPath, path)) {
+        remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/*
+Convert all the jobs on a pool of threads, each thread takes the next
+unconverted job until there are none left
+ */
+void convertSprites(vector<SpriteJob> &jobs, SpriteOptions options,
+        unsigned threadCount, const Manifest &previous) {
+    atomic<size_t> next(0);
+
+    // the threads there are no sprites for format the blocks of the others
+    if (threadCount > jobs.size()) {
+        options.tileThreads = threadCount / jobs.size();
+    }
+
+    auto worker = [&]() {
+        // one decoder context per thread, reused by every sprite the thread converts
+        lodepng::DecoderContext context;
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            convertSprite(jobs[i], options, context, previous);
+        }
+    };
+
+    if (threadCount > jobs.size()) {
+        threadCount = jobs.size();
+    }
+
+    vector<thread> pool;
+    for (unsigned t = 1; t < threadCount; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+
+    for (auto &it : pool) {
+        it.join();
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    cout << "mksprite64 by Nathan Duma." << endl;
+    cout << "Convert png to c source file for the Nintendo 64, using the sprite & bitmap structure." << endl;
+    cout << "Type -h for usage" << endl;
+    if (argc == 1) {
+        cerr << "ERROR 1: no argument provided." << endl;
+        return 1;
+    }
+
+    SpriteOptions options;
+    vector<string> files;
+
+    bool stats = false;
+    bool help = false;
+    unsigned threadCount = thread::hardware_concurrency();
+
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+
+
+    // parse arguments
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            stats = true;
+            continue;
+        }
+
+        if (argv[i][0] == '@') {
+            if (!readListFile(argv[i] + 1, files)) {
+                cerr << "ERROR 5: unable to read list file: " << argv[i] + 1 << endl;
+                return 5;
+            }
+            continue;
+        }
+
+        if ((i + 1) >= argc) {
+            cerr << "ERROR 2: argument-parameter mismatch" << endl;
+            return 2;
+        }
+
+        if ((argv[i][0] == '-') && (argv[i][1] != '\0')) {
+            if (argv[i][1] == 'h') {
+                help = true;
+                cout << "Usage:" << endl;
+                cout << "Specify file path (must end in .png): -f file.png" << endl;
+                cout << "Or convert every png in a directory: -d dir" << endl;
+                cout << "Or convert the files listed in a text file: @listfile" << endl;
+                cout << "OPTIONAL:" << endl;
+                cout << "Scale in x direction: -sx scaleX" << endl;
+                cout << "Scale in y direction: -sy scaleY" << endl;
+                cout << "Scale is 1.0 by default." << endl;
+                cout << "n-bit mode (n=16 or n=32): -m n" << endl;
+                cout << "colour indexed mode with a TLUT (ci4 or ci8): -m ci4/ci8" << endl;
+                cout << "Mode is 16 by default." << endl;
+                cout << "Block size (a=automatic from TMEM, f=fixed 32x32): -b a/f" << endl;
+                cout << "Block size is fixed by default." << endl;
+                cout << "Trim the blocks on the right and bottom edges to the image: -e t/f" << endl;
+                cout << "Trimming is false by default." << endl;
+                cout << "Drop fully transparent blocks: -t t/f" << endl;
+                cout << "Dropping is false by default." << endl;
+                cout << "Show preview in c file: -p t/f" << endl;
+                cout << "Preview is false by default." << endl;
+                cout << "common_sprites.h mode (a=append, s=sorted): -c a/s" << endl;
+                cout << "Mode is append by default." << endl;
+                cout << "Skip sprites unchanged since the last run: -i t/f" << endl;
+                cout << "Incremental is false by default." << endl;
+                cout << "Number of files converted at once: -j n" << endl;
+                cout << "Jobs is the number of cores by default." << endl;
+                cout << "Print output write statistics: --stats" << endl;
+            } else if (argv[i][1] == 's' && (argv[i][2] != '\0')) {
+                if (argv[i][2] == 'x') {
+                    options.scaleX = argv[i + 1];
+                } else if (argv[i][2] == 'y') {
+                    options.scaleY = argv[i + 1];
+                } else {
+                    cerr << "ERROR 3: Unknown command: " << argv[i] << endl;
+                    return 3;
+                }
+
+                i++;
+            } else if (argv[i][1] == 'f') {
+                files.push_back(argv[i + 1]);
+                i++;
+            } else if (argv[i][1] == 'd') {
+                if (!listDirectory(argv[i + 1], files)) {
+                    cerr << "ERROR 5: unable to read directory: " << argv[i + 1] << endl;
+                    return 5;
+                }
+                i++;
+            } else if (argv[i][1] == 'j') {
+                int jobs = atoi(argv[i + 1]);
+                if (jobs <= 0) {
+                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
+                    return 3;
+                }
+                threadCount = jobs;
+                i++;
+            } else if (argv[i][1] == 'p') {
+                if (argv[i + 1][0] == 't') {
+                    options.preview = true;
+                } else if (argv[i + 1][0] == 'f') {
+                    options.preview = false;
+                } else {
+                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
+                    return 3;
+                }
+                i++;
+            } else if (argv[i][1] == 'b') {
+                if (argv[i + 1][0] == 'a') {
+                    options.autoBlocks = true;
+                } else if (argv[i + 1][0] == 'f') {
+                    options.autoBlocks = false;
+                } else {
+                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
+                    return 3;
+                }
+                i++;
+            } else if (argv[i][1] == 'e') {
+                if (argv[i + 1][0] == 't') {
+                    options.trimEdges = true;
+                } else if (argv[i + 1][0] == 'f') {
+                    options.trimEdges = false;
+                } else {
+                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
+                    return 3;
+                }
+                i++;
+            } else if (argv[i][1] == 't') {
+                if (argv[i + 1][0] == 't') {
+                    options.cullClear = true;
+                } else if (argv[i + 1][0] == 'f') {
+                    options.cullClear = false;
+                } else {
+                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
+                    return 3;
+                }
+                i++;
+            } else if (argv[i][1] == 'i') {
+                if (argv[i + 1][0] == 't') {
+                    options.incremental = true;
+                } else if (argv[i + 1][0] == 'f') {
+                    options.incremental = false;
+                } else {
+                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
+                    return 3;
+                }
+                i++;
+            } else if (argv[i][1] == 'c') {
+                if (argv[i + 1][0] == 'a') {
+                    options.sortedCommon = false;
+                } else if (argv[i + 1][0] == 's') {
+                    options.sortedCommon = true;
+                } else {
+                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
+                    return 3;
+                }
+                i++;
+            } else if (argv[i][1] == 'm') {
+                options.mode = argv[i + 1];
+                // TODO: check for errors on this
+                if (!(options.mode == "16" || options.mode == "32"
+                        || options.mode == "ci4" || options.mode == "ci8")) {
+                    cerr << "ERROR 3: Unknown command: " << argv[i + 1] << endl;
+                    return 3;
+                }
+                i++;
+            } else {
+                cerr << "ERROR 3: Unknown command: " << argv[i] << endl;
+                return 3;
+            }
+        }
+    }
+
+    if (files.empty()) {
+        if (help) {
+            return 0;
+        }
+        cerr << "ERROR 6: no input files" << endl;
+        return 6;
+    }
+
+    vector<SpriteJob> jobs(files.size());
+
+    for (size_t i = 0; i < files.size(); i++) {
+        jobs[i].file = files[i];
+        jobs[i].name = spriteName(files[i]);
+    }
+
+    // what earlier incremental runs converted
+    Manifest previous;
+    if (options.incremental) {
+        readManifest(manifestPath, previous);
+    }
+
+    convertSprites(jobs, options, threadCount, previous);
+
+    // have all of them included in 1 h file
+    // only this thread writes it, once every sprite is done
+    vector<string> includes;
+    unsigned error = 0;
+    size_t converted = 0;
+    size_t skipped = 0;
+
+    for (auto &it : jobs) {
+        if (it.error) {
+            if (jobs.size() > 1) {
+                cout << it.file << ": ";
+            }
+            cout << it.message << endl;
+
+            if (!error) {
+                error = it.error;
+            }
+        } else {
+            // appending an unchanged sprite again would only add a duplicate,
+            // the sorted header is left as it is when nothing is new
+            if (!it.skipped || options.sortedCommon) {
+                includes.push_back("#include \"sp_" + it.name + ".h\"");
+            }
+            converted++;
+            if (it.skipped) {
+                skipped++;
+            } else if (options.autoBlocks) {
+                if (jobs.size() > 1) {
+                    cout << it.file << ": ";
+                }
+                cout << it.loads << " RDP tile loads" << endl;
+            }
+        }
+    }
+
+    // a run that isn't incremental still has to drop the sprites it
+    // rewrote from an existing manifest, their options may have changed
+    unsigned long long manifestSize;
+    bool updateManifest = options.incremental || fileSize(manifestPath, manifestSize);
+    if (updateManifest && !writeManifest(manifestPath, jobs)) {
+        cerr << "ERROR 4: unable to write " << manifestPath << endl;
+        return 4;
+    }
+
+    if (!includes.empty()) {
+        if (options.sortedCommon) {
+            if (!writeSortedCommonHeader("common_sprites.h", includes)) {
+                cerr << "ERROR 4: unable to write common_sprites.h" << endl;
+                return 4;
+            }
+        } else {
+            ofstream common("common_sprites.h", std::ios_base::app);
+            for (auto &it : includes) {
+                common << it << endl;
+            }
+            common.close();
+        }
+    }
+
+    if (jobs.size() > 1) {
+        cout << "converted " << converted << " of " << jobs.size() << " files" << endl;
+    }
+
+    if (options.incremental) {
+        cout << skipped << " unchanged since the last run" << endl;
+    }
+
+    if (stats) {
+        cout << "stats: " << OutputBuffer::writeCalls.load() << " write calls, "
+                << OutputBuffer::bytesWritten.load() << " bytes" << endl;
+    }
+
+    return error;
+}
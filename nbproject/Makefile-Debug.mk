@@ -33,11 +33,22 @@ include Makefile
 # Object Directory
 OBJECTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}
 
+# Test Directory
+TESTDIR=${CND_BUILDDIR}/${CND_CONF}/${CND_PLATFORM}/tests
+
 # Object Files
 OBJECTFILES= \
 	${OBJECTDIR}/lodepng.o \
 	${OBJECTDIR}/main.o
 
+# Test Files
+TESTFILES= \
+	${TESTDIR}/TestFiles/f1
+
+# Test Object Files
+TESTOBJECTFILES= \
+	${TESTDIR}/tests/adler32test.o \
+	${TESTDIR}/tests/inflatebench.o
 
 # C Compiler Flags
 CFLAGS=
@@ -61,21 +72,56 @@ LDLIBSOPTIONS=
 
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/mksprite64.exe: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
-	${LINK.cc} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/mksprite64 ${OBJECTFILES} ${LDLIBSOPTIONS}
+	${LINK.cc} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/mksprite64 ${OBJECTFILES} ${LDLIBSOPTIONS} -pthread
 
 ${OBJECTDIR}/lodepng.o: lodepng.cc
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.cc) -g -std=c++14 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/lodepng.o lodepng.cc
+	$(COMPILE.cc) -g -pthread -std=c++14 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/lodepng.o lodepng.cc
 
 ${OBJECTDIR}/main.o: main.cc
 	${MKDIR} -p ${OBJECTDIR}
 	${RM} "$@.d"
-	$(COMPILE.cc) -g -std=c++14 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.cc
+	$(COMPILE.cc) -g -pthread -std=c++14 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.cc
 
 # Subprojects
 .build-subprojects:
 
+# Build Test Targets
+.build-tests-conf: .build-tests-subprojects .build-conf ${TESTFILES}
+.build-tests-subprojects:
+
+${TESTDIR}/TestFiles/f1: ${TESTDIR}/tests/adler32test.o
+	${MKDIR} -p ${TESTDIR}/TestFiles
+	${LINK.cc} -o ${TESTDIR}/TestFiles/f1 $^ ${LDLIBSOPTIONS} -pthread
+
+${TESTDIR}/tests/adler32test.o: tests/adler32test.cc lodepng.cc
+	${MKDIR} -p ${TESTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -pthread -std=c++14 -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/adler32test.o tests/adler32test.cc
+
+# Benchmark Targets
+.bench-conf: .build-conf ${TESTDIR}/inflatebench
+	${TESTDIR}/inflatebench
+
+${TESTDIR}/inflatebench: ${TESTDIR}/tests/inflatebench.o ${OBJECTDIR}/lodepng.o
+	${MKDIR} -p ${TESTDIR}
+	${LINK.cc} -o ${TESTDIR}/inflatebench $^ ${LDLIBSOPTIONS} -pthread
+
+${TESTDIR}/tests/inflatebench.o: tests/inflatebench.cc
+	${MKDIR} -p ${TESTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.cc) -g -pthread -std=c++14 -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/inflatebench.o tests/inflatebench.cc
+
+# Run Test Targets
+.test-conf:
+	@if [ "${TEST}" = "" ]; \
+	then  \
+	    ${TESTDIR}/TestFiles/f1; \
+	else  \
+	    ./${TEST}; \
+	fi
+
 # Clean Targets
 .clean-conf: ${CLEAN_SUBPROJECTS}
 	${RM} -r ${CND_BUILDDIR}/${CND_CONF}
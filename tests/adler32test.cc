@@ -0,0 +1,107 @@
+/*
+Checks the SIMD Adler-32 kernels and update_adler32 against a reference that
+reduces after every byte. lodepng.cc is included so its static functions can
+be called directly.
+ */
+
+#include "../lodepng.cc"
+
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static unsigned failures = 0;
+
+/*
+Adler-32 the way the zlib specification states it, modulo after every byte
+ */
+static unsigned referenceAdler32(unsigned adler, const unsigned char *data, size_t len) {
+    unsigned s1 = adler & 0xffff;
+    unsigned s2 = (adler >> 16) & 0xffff;
+    for (size_t i = 0; i < len; i++) {
+        s1 = (s1 + data[i]) % 65521;
+        s2 = (s2 + s1) % 65521;
+    }
+    return (s2 << 16) | s1;
+}
+
+static void expect(const char *what, unsigned got, unsigned expected,
+        size_t len, size_t offset, unsigned start) {
+    if (got != expected) {
+        if (failures < 20) {
+            cout << what << ": len " << len << " offset " << offset << " start " << hex << start
+                    << " got " << got << " expected " << expected << dec << endl;
+        }
+        failures++;
+    }
+}
+
+/*
+Compare every kernel the CPU supports and the dispatcher with the reference
+for one buffer, the kernels only on the whole 32-byte blocks they take
+ */
+static void check(const unsigned char *data, size_t len, size_t offset, unsigned start) {
+    unsigned expected = referenceAdler32(start, data, len);
+    expect("update_adler32", update_adler32(start, data, (unsigned) len), expected, len, offset, start);
+
+#ifdef LODEPNG_COMPILE_X86_SIMD
+    unsigned features = lodepng_cpu_features();
+    unsigned blocks = (unsigned) len & ~31u;
+    unsigned blocksExpected = referenceAdler32(start, data, blocks);
+    if (features & LODEPNG_CPU_SSSE3) {
+        expect("adler32_ssse3", adler32_ssse3(start, data, blocks), blocksExpected, len, offset, start);
+    }
+#ifdef LODEPNG_COMPILE_X86_AVX2
+    if (features & LODEPNG_CPU_AVX2) {
+        expect("adler32_avx2", adler32_avx2(start, data, blocks), blocksExpected, len, offset, start);
+    }
+#endif
+#endif
+}
+
+int main() {
+    // 0xff bytes are the worst case for the deferred modulo of the kernels
+    const size_t maxLen = 3000, offsets = 8;
+    const size_t bigLens[] = {5535, 5536, 5537, 5568, 11072, 11104, 65536, 1 << 20};
+    const unsigned starts[] = {1, 0xfff0fff0};
+
+    vector<unsigned char> random(offsets + (1 << 20)), ones(offsets + (1 << 20), 0xff);
+    unsigned seed = 12345;
+    for (auto &it : random) {
+        seed = seed * 1103515245 + 12345;
+        it = (unsigned char) (seed >> 16);
+    }
+
+    for (unsigned start : starts) {
+        for (size_t offset = 0; offset < offsets; offset++) {
+            for (size_t len = 0; len <= maxLen; len++) {
+                check(&random[offset], len, offset, start);
+                check(&ones[offset], len, offset, start);
+            }
+            for (size_t len : bigLens) {
+                check(&random[offset], len, offset, start);
+                check(&ones[offset], len, offset, start);
+            }
+        }
+    }
+
+#ifdef LODEPNG_COMPILE_X86_SIMD
+    unsigned features = lodepng_cpu_features();
+    cout << "kernels checked: scalar"
+            << (features & LODEPNG_CPU_SSSE3 ? ", ssse3" : "")
+#ifdef LODEPNG_COMPILE_X86_AVX2
+            << (features & LODEPNG_CPU_AVX2 ? ", avx2" : "")
+#endif
+            << endl;
+#else
+    cout << "kernels checked: scalar" << endl;
+#endif
+
+    if (failures) {
+        cout << failures << " mismatches" << endl;
+        return 1;
+    }
+    cout << "adler32 test passed" << endl;
+    return 0;
+}
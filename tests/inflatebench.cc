@@ -0,0 +1,113 @@
+/*
+Times lodepng_inflate on the IDAT stream of a run-heavy sprite and of a
+gradient. Most matches in the sprite overlap their source (distance 1 for a
+flat row of one channel, 4 for repeated RGBA pixels), which is where
+copyOverlappingMatch pays off; the gradient is there for comparison.
+Build with CONF=Release for meaningful numbers.
+ */
+
+#include "../lodepng.h"
+
+#include <chrono>
+#include <iostream>
+#include <string.h>
+#include <vector>
+
+using namespace std;
+
+static const unsigned imageSize = 1024;
+static const int iterations = 50;
+
+/*
+Flat coloured bands inside a fully transparent border, like most sprites
+ */
+static vector<unsigned char> spriteImage() {
+    const unsigned char colours[4][4] = {
+        {200, 40, 40, 255}, {40, 200, 40, 255}, {40, 40, 200, 255}, {250, 250, 250, 255}
+    };
+    vector<unsigned char> image(imageSize * imageSize * 4, 0);
+    for (unsigned y = 128; y < imageSize - 128; y++) {
+        for (unsigned x = 128; x < imageSize - 128; x++) {
+            memcpy(&image[(y * imageSize + x) * 4], colours[(y / 64) % 4], 4);
+        }
+    }
+    return image;
+}
+
+static vector<unsigned char> gradientImage() {
+    vector<unsigned char> image(imageSize * imageSize * 4);
+    for (unsigned y = 0; y < imageSize; y++) {
+        for (unsigned x = 0; x < imageSize; x++) {
+            unsigned char *p = &image[(y * imageSize + x) * 4];
+            p[0] = (unsigned char) x;
+            p[1] = (unsigned char) y;
+            p[2] = (unsigned char) (x + y);
+            p[3] = 255;
+        }
+    }
+    return image;
+}
+
+/*
+Encode the image as RGBA8, like the sprites mksprite64 reads, and return its
+deflate stream: the IDAT data without the 2-byte zlib header
+ */
+static vector<unsigned char> deflateStream(const vector<unsigned char> &image) {
+    vector<unsigned char> png, zlib;
+    lodepng::State state;
+    state.encoder.auto_convert = 0;
+    if (lodepng::encode(png, image.data(), imageSize, imageSize, state)) {
+        return zlib;
+    }
+
+    const unsigned char *end = png.data() + png.size();
+    for (const unsigned char *chunk = png.data() + 8; chunk + 12 <= end;
+            chunk = lodepng_chunk_next_const(chunk)) {
+        if (lodepng_chunk_type_equals(chunk, "IDAT")) {
+            const unsigned char *data = lodepng_chunk_data_const(chunk);
+            zlib.insert(zlib.end(), data, data + lodepng_chunk_length(chunk));
+        }
+        if (lodepng_chunk_type_equals(chunk, "IEND")) {
+            break;
+        }
+    }
+    return vector<unsigned char>(zlib.begin() + (zlib.size() < 2 ? zlib.size() : 2), zlib.end());
+}
+
+static bool bench(const char *name, const vector<unsigned char> &image) {
+    vector<unsigned char> stream = deflateStream(image);
+    if (stream.empty()) {
+        cout << name << ": encoding failed" << endl;
+        return false;
+    }
+
+    double best = 1e30;
+    size_t outsize = 0;
+    for (int i = 0; i < iterations; i++) {
+        unsigned char *out = 0;
+        outsize = 0;
+        auto start = chrono::steady_clock::now();
+        unsigned error = lodepng_inflate(&out, &outsize, stream.data(), stream.size(),
+                &lodepng_default_decompress_settings);
+        auto stop = chrono::steady_clock::now();
+        free(out);
+        if (error) {
+            cout << name << ": " << lodepng_error_text(error) << endl;
+            return false;
+        }
+        double ms = chrono::duration<double, milli>(stop - start).count();
+        if (ms < best) {
+            best = ms;
+        }
+    }
+
+    cout << name << ": " << stream.size() << " -> " << outsize << " bytes, best of "
+            << iterations << " " << best << " ms, " << outsize / best / 1000.0 << " MB/s" << endl;
+    return true;
+}
+
+int main() {
+    bool ok = bench("sprite", spriteImage());
+    ok = bench("gradient", gradientImage()) && ok;
+    return ok ? 0 : 1;
+}